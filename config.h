@@ -32,7 +32,10 @@
   "binary-bal.rep",\
   "binary2-bal.rep",\
   "realloc-bal.rep",\
-  "realloc2-bal.rep"
+  "realloc2-bal.rep",\
+  "batch-bal.rep",\
+  "align-bal.rep",\
+  "calloc-bal.rep"
 
 /*
  * This constant gives the estimated performance of the libc malloc
@@ -53,15 +56,153 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes: 8 in the 32-bit build, 16 in a native
+ * LP64 build as the x86-64 ABI asks of malloc
  */
-#define ALIGNMENT 8  
+#if defined(__LP64__)
+#define ALIGNMENT 16
+#else
+#define ALIGNMENT 8
+#endif
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes, per arena. This is the default, mdriver -H
+ * sets it at run time through mem_set_heap_max. A heap may grow past
+ * 4 GB, a single block stays within what its 32-bit header holds.
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Huge page size mdriver -P puts the heap on for its second timing run
+ */
+#define HUGE_PAGESIZE (2*(1<<20))  /* 2 MB */
+
+/*
+ * Allocator build options. Each can be overridden from the make command
+ * line, e.g. make MMFLAGS=-DCOMPACT_LINKS=1
+ */
+
+/*
+ * Store the free-tree links as 32-bit offsets from the start of the heap
+ * in 8-byte units (heaps up to 32 GB) instead of 64-bit words. This
+ * shrinks the minimum block from 40 to 24 bytes.
+ */
+#ifndef COMPACT_LINKS
+#define COMPACT_LINKS 0
+#endif
+
+/*
+ * Use the top-down red-black tree, which keeps no parent link in the free
+ * blocks and rebalances in a single pass on the way down. One link less
+ * per node: the minimum block drops by 8 bytes (4 with COMPACT_LINKS).
+ */
+#ifndef TOPDOWN_TREE
+#define TOPDOWN_TREE 0
+#endif
+
+/*
+ * Free block index behind malloc: the red-black tree keeps free blocks
+ * ordered by size for a best fit, TLSF (two-level segregated fit) finds
+ * a large enough list with two bitmap lookups in constant time and
+ * trades some utilization for that bound. TOPDOWN_TREE only applies to
+ * the tree.
+ */
+#define FREE_INDEX_RBTREE 0
+#define FREE_INDEX_TLSF   1
+#ifndef FREE_INDEX
+#define FREE_INDEX FREE_INDEX_RBTREE
+#endif
+
+/*
+ * Split the red-black tree into a forest of one tree per power of two of
+ * the block size, with a bitmap of the non-empty ones. Still best fit,
+ * but a search only descends the small tree of its own class, or goes
+ * straight to the smallest block of the next non-empty class.
+ */
+#ifndef TREE_FOREST
+#define TREE_FOREST 0
+#endif
+
+/*
+ * Defer coalescing: free parks blocks in a small unsorted buffer without
+ * touching the free index, malloc reuses a parked block of the right size
+ * first, and the buffer is coalesced into the index in one pass when it
+ * fills up or an index search fails.
+ */
+#ifndef DEFER_COALESCE
+#define DEFER_COALESCE 0
+#endif
+
+/*
+ * Number of arenas. With more than one, mm_malloc, mm_free and
+ * mm_realloc are thread safe: each thread is bound to an arena
+ * round-robin and allocates from it under the arena's spin lock. A free
+ * of a block from another thread's arena never takes that lock: the
+ * block is pushed on the arena's lock-free queue and merged by the next
+ * malloc there. Every arena is a contiguous heap in its own MAX_HEAP
+ * slice of the memlib region.
+ */
+#ifndef MM_ARENAS
+#define MM_ARENAS 1
+#endif
+
+/*
+ * Most heaps mm_heap_create can have in use at once, each is a memlib
+ * slice of its own besides those of the arenas
+ */
+#ifndef MM_HEAPS
+#define MM_HEAPS 16
+#endif
+
+/*
+ * Per-thread caches of ready blocks for small requests, in front of the
+ * arenas. A class refills with a batch of blocks under one arena lock
+ * and hands a batch back when it overflows, so most small mallocs and
+ * frees take no lock at all.
+ */
+#ifndef THREAD_CACHE
+#define THREAD_CACHE 0
+#endif
+
+/*
+ * Give memory back: when a free leaves a free block at the end of an
+ * arena's heap larger than this many bytes, the block is cut off and the
+ * brk moved down over it. 0 keeps the heap at its peak size.
+ */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (128*1024)
+#endif
+
+/*
+ * When the brk moves down, memlib keeps this many bytes above it
+ * committed and gives the rest of the committed memory back to the OS.
+ * A heap that shrinks and grows back within it takes no page faults.
+ * 0 never gives committed memory back.
+ */
+#ifndef DECOMMIT_THRESHOLD
+#define DECOMMIT_THRESHOLD (16*(1<<20))
+#endif
+
+/*
+ * Requests larger than this many bytes get a page-granular mapping of
+ * their own outside the arenas. It is unmapped as soon as the block is
+ * freed, and realloc resizes it by remapping pages rather than copying.
+ * 0 serves every request from the arenas.
+ */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (128*1024)
+#endif
+
+/*
+ * Profile the hot path: histograms of rdtsc cycles per mm_malloc, mm_free
+ * and mm_realloc call, of tree nodes visited per free index search and of
+ * rotations per insert and delete. mdriver prints them for each trace.
+ * Off, the probes compile to nothing.
+ */
+#ifndef MM_PROFILE
+#define MM_PROFILE 0
+#endif
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -31,7 +31,7 @@
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p, align)  ((((size_t)(p)) % (align)) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -46,9 +46,12 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH, MEMALIGN, CALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int count;                        /* ids index.. of a batch request,
+					 members of a calloc of size bytes */
+    int align;                        /* alignment of a memalign request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -81,6 +84,8 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double heap;     /* heap size in bytes at the end of the trace */
+    double hits;     /* thread cache hit rate in the timed runs (THREAD_CACHE) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -106,7 +111,7 @@ static char *default_tracefiles[] = {
  *********************/
 
 /* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
@@ -114,6 +119,7 @@ static void clear_ranges(range_t **ranges);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
+static void scale_trace(trace_t *trace, int copies);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -122,14 +128,25 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   double *final_heap);
 static void eval_mm_speed(void *ptr);
 
+/* Self-checks of the mm calls no trace makes */
+static void check_heaps(void);
+static void check_regions(void);
+static void check_pools(void);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void print_mm_stats(void);
+#if MM_PROFILE
+static void print_profile(void);
+#endif
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
+static void api_error(char *call, char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -145,20 +162,30 @@ int main(int argc, char **argv)
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t *huge_stats = NULL;/* mm stats on huge heap pages */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int scale = 1;       /* Copies of each trace to time (set by -s) */
+    int huge_pages = 0;  /* If set, time mm again on huge pages (set by -P) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
+    double huge_secs, huge_ops;
     int numcorrect;
+#if THREAD_CACHE
+    unsigned long lookups0, hits0, lookups, hits; /* thread cache counters */
+#endif
+#if MM_PROFILE
+    mm_profile_t prof;   /* discards what the correctness checks recorded */
+#endif
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:H:s:hvVgalP")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +205,28 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'H': /* Heap size of each arena in MB */
+	    if (atol(optarg) <= 0) {
+		usage();
+		exit(1);
+	    }
+	    mem_set_heap_max((size_t)atol(optarg) << 20);
+	    break;
+	case 's': /* Interleave this many copies of each trace */
+	    if ((scale = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'P': /* Time mm malloc on huge heap pages as well */
+            huge_pages = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -225,6 +268,42 @@ int main(int argc, char **argv)
 	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+    /* Report how the allocator was built, so runs can be compared */
+    printf("Free links: %s\n", COMPACT_LINKS ? 
+	   "compact (32-bit heap offsets)" : "full (64-bit words)");
+    printf("Free index: %s%s\n", FREE_INDEX == FREE_INDEX_TLSF ?
+	   "TLSF, two-level segregated lists" : TOPDOWN_TREE ? 
+	   "top-down red-black, no parent links" : "red-black with parent links",
+	   FREE_INDEX == FREE_INDEX_RBTREE && TREE_FOREST ?
+	   ", one tree per power of two" : "");
+    printf("Coalescing: %s\n", DEFER_COALESCE ?
+	   "deferred, through an unsorted free buffer" : "immediate, on every free");
+    printf("Arenas: %d%s\n", MM_ARENAS, MM_ARENAS > 1 ?
+	   ", threads bound round-robin" : "");
+    printf("Heaps: up to %d from mm_heap_create\n", MM_HEAPS);
+    printf("Thread cache: %s\n", THREAD_CACHE ?
+	   "on, batched refill and flush" : "off");
+    if (TRIM_THRESHOLD > 0)
+	printf("Heap trimming: free blocks over %d bytes at the heap end\n",
+	       TRIM_THRESHOLD);
+    else
+	printf("Heap trimming: off\n");
+    if (DECOMMIT_THRESHOLD > 0)
+	printf("Decommit: committed memory over %d bytes above the brk\n",
+	       DECOMMIT_THRESHOLD);
+    else
+	printf("Decommit: off\n");
+    if (MMAP_THRESHOLD > 0)
+	printf("Huge blocks: mapped above %d bytes\n", MMAP_THRESHOLD);
+    else
+	printf("Huge blocks: off, all requests from the heap\n");
+    printf("Profiling: %s\n", MM_PROFILE ?
+	   "on, histograms per trace" : "off");
+    printf("Heap: %lu MB per arena, %d-byte alignment\n",
+	   (unsigned long)(mem_heap_max() >> 20), ALIGNMENT);
+    if (scale > 1)
+	printf("Scale: %d interleaved copies of each trace\n", scale);
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -258,6 +337,8 @@ int main(int argc, char **argv)
 		printf("Checking libc malloc for correctness, ");
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
 	    if (libc_stats[i].valid) {
+		scale_trace(trace, scale);
+		libc_stats[i].ops = trace->num_ops;
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
@@ -295,14 +376,36 @@ int main(int argc, char **argv)
 	    printf("Checking mm_malloc for correctness, ");
 	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
 	if (mm_stats[i].valid) {
+	    scale_trace(trace, scale); /* validation is quadratic, time only */
+	    mm_stats[i].ops = trace->num_ops;
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].util = eval_mm_util(trace, i, &ranges,
+					     &mm_stats[i].heap);
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
+#if THREAD_CACHE
+	    mm_cache_stats(&lookups0, &hits0);
+#endif
+#if MM_PROFILE
+	    mm_get_profile(&prof); /* only the timed runs count */
+#endif
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+#if MM_PROFILE
+	    if (verbose) {
+		printf("Profile of trace %d (%s):\n", i, tracefiles[i]);
+		print_profile();
+	    }
+#endif
+	    if (verbose > 1)
+		print_mm_stats();
+#if THREAD_CACHE
+	    mm_cache_stats(&lookups, &hits);
+	    if (lookups > lookups0)
+		mm_stats[i].hits = (double)(hits - hits0) / (lookups - lookups0);
+#endif
 	}
 	free_trace(trace);
     }
@@ -311,9 +414,25 @@ int main(int argc, char **argv)
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+#if THREAD_CACHE
+	printf("\nThread cache hit rate:\n");
+	for (i=0; i < num_tracefiles; i++)
+	    if (mm_stats[i].valid)
+		printf("%2d%9.0f%%\n", i, mm_stats[i].hits*100.0);
+#endif
 	printf("\n");
     }
 
+    /*
+     * Check the calls the traces do not make, errors count as above
+     */
+    if (verbose > 1)
+	printf("Checking mm heaps, regions and pools\n");
+    if (MM_HEAPS > 0)
+	check_heaps();
+    check_regions();
+    check_pools();
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -357,11 +476,62 @@ int main(int argc, char **argv)
 	printf("Terminated with %d errors\n", errors);
     }
 
+    /*
+     * Optionally run the mm package again with the heap on huge pages,
+     * to compare the throughput of both page sizes
+     */
+    if (huge_pages) {
+	huge_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (huge_stats == NULL)
+	    unix_error("huge_stats calloc in main failed");
+	mem_deinit();
+	mem_set_heap_pages(HUGE_PAGESIZE);
+	mem_init();
+	if (verbose > 1)
+	    printf("\nTesting mm malloc on %s huge pages\n",
+		   mem_heap_hugetlb() ? "explicit" : "transparent");
+
+	huge_secs = 0;
+	huge_ops = 0;
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    huge_stats[i].ops = trace->num_ops;
+	    huge_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	    if (huge_stats[i].valid) {
+		scale_trace(trace, scale);
+		huge_stats[i].ops = trace->num_ops;
+		huge_stats[i].util = eval_mm_util(trace, i, &ranges,
+						   &huge_stats[i].heap);
+		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		huge_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+		huge_secs += huge_stats[i].secs;
+		huge_ops += huge_stats[i].ops;
+	    }
+	    free_trace(trace);
+	}
+
+	if (verbose) {
+	    printf("\nResults for mm malloc on %lu KB %s pages:\n",
+		   (unsigned long)(mem_heap_pagesize() >> 10),
+		   mem_heap_hugetlb() ? "explicit" : "transparent");
+	    printresults(num_tracefiles, huge_stats);
+	}
+	printf("Throughput: %.0f Kops on %lu KB pages, %.0f Kops on %lu KB %s pages\n",
+	       ops / (secs * 1e3), (unsigned long)(mem_pagesize() >> 10),
+	       huge_ops / (huge_secs * 1e3),
+	       (unsigned long)(mem_heap_pagesize() >> 10),
+	       mem_heap_hugetlb() ? "explicit" : "transparent");
+    }
+
     if (autograder) {
 	printf("correct:%d\n", numcorrect);
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    free(libc_stats);
+    free(mm_stats);
+    free(huge_stats);
     exit(0);
 }
 
@@ -375,10 +545,10 @@ int main(int argc, char **argv)
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     size bytes at addr lo, aligned to align bytes. After checking the
+ *     block for correctness, we create a range struct for this block and add it to the range list. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
@@ -387,17 +557,18 @@ static int add_range(range_t **ranges, char *lo, int size,
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
+    /* Payload addresses must be ALIGNMENT-byte aligned, or more if asked */
+    if (!IS_ALIGNED(lo, align)) {
 	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
-		lo, ALIGNMENT);
+		lo, align);
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or a mapping */
+    if (!mem_mapped(lo, hi) &&
+	((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -477,7 +648,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    unsigned index, size, count, align;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -539,6 +710,36 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'm': /* memalign */
+	    fscanf(tracefile, "%u %u %u", &index, &align, &size);
+	    trace->ops[op_index].type = MEMALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].align = align;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'c': /* calloc of count members of size bytes */
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'A': /* allocate ids index..index+count-1 in one batch */
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    trace->ops[op_index].type = ALLOC_BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    trace->ops[op_index].size = size;
+	    max_index = (index + count - 1 > max_index) ? index + count - 1 : max_index;
+	    break;
+	case 'F': /* free ids index..index+count-1 in one batch */
+	    fscanf(tracefile, "%u %u", &index, &count);
+	    trace->ops[op_index].type = FREE_BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -566,6 +767,39 @@ void free_trace(trace_t *trace)
     free(trace);              /* and the trace record itself... */
 }
 
+/*
+ * scale_trace - Interleave copies of the trace in place: each request
+ *     is repeated copies times, copy k on ids shifted by k * num_ids.
+ *     The live set grows copies fold with the same request mix.
+ */
+static void scale_trace(trace_t *trace, int copies)
+{
+    traceop_t *ops;
+    int i, k;
+
+    if (copies <= 1)
+	return;
+    if ((ops = (traceop_t *)malloc((size_t)trace->num_ops * copies *
+				   sizeof(traceop_t))) == NULL)
+	unix_error("malloc failed in scale_trace");
+    for (i = 0; i < trace->num_ops; i++)
+	for (k = 0; k < copies; k++) {
+	    ops[i * copies + k] = trace->ops[i];
+	    ops[i * copies + k].index += k * trace->num_ids;
+	}
+    free(trace->ops);
+    trace->ops = ops;
+    trace->num_ops *= copies;
+    trace->num_ids *= copies;
+
+    if ((trace->blocks = (char **)realloc(trace->blocks,
+	 (size_t)trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("realloc of blocks failed in scale_trace");
+    if ((trace->block_sizes = (size_t *)realloc(trace->block_sizes,
+	 (size_t)trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("realloc of block_sizes failed in scale_trace");
+}
+
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
  * and throughput of the libc and mm malloc packages.
@@ -579,6 +813,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     int i, j;
     int index;
     int size;
+    int count;
     int oldsize;
     char *newp;
     char *oldp;
@@ -614,7 +849,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -642,7 +877,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if (add_range(ranges, newp, size, ALIGNMENT, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -653,7 +888,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -674,6 +909,70 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    mm_free(p);
 	    break;
 
+        case MEMALIGN: /* mm_memalign */
+
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_memalign failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, trace->ops[i].align, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case CALLOC: /* mm_calloc */
+
+	    count = trace->ops[i].count;
+	    if ((p = mm_calloc(count, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_calloc failed.");
+		return 0;
+	    }
+	    size *= count;
+	    if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
+		return 0;
+
+	    /* The block must come back zeroed, then it is filled as usual */
+	    for (j = 0; j < size; j++) {
+		if (p[j] != 0) {
+		    malloc_error(tracenum, i, "mm_calloc did not zero the block");
+		    return 0;
+		}
+	    }
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+
+	    /* The blocks land straight in the ids' slots */
+	    count = trace->ops[i].count;
+	    if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) != count) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+
+	    /* Check and fill each block as for mm_malloc */
+	    for (j = 0; j < count; j++) {
+		p = trace->blocks[index + j];
+		if (add_range(ranges, p, size, ALIGNMENT, tracenum, i) == 0)
+		    return 0;
+		memset(p, (index + j) & 0xFF, size);
+		trace->block_sizes[index + j] = size;
+	    }
+	    break;
+
+        case FREE_BATCH: /* mm_free_batch */
+
+	    /* mm_free_batch reorders the slots, they are dead afterwards */
+	    count = trace->ops[i].count;
+	    for (j = 0; j < count; j++)
+		remove_range(ranges, trace->blocks[index + j]);
+	    mm_free_batch((void **)&trace->blocks[index], count);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -689,19 +988,20 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   high water mark of the heap size while running the student's malloc 
+ *   package on the trace. mem_sbrk() lets the package decrement the
+ *   brk pointer, so the heap size at the end of the trace is returned
+ *   in final_heap as well. Bytes in mem_map() mappings count as heap.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   double *final_heap)
 {   
-    int i;
-    int index;
+    int i, j;
+    int index, count;
     int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    size_t max_total_size = 0;
+    size_t total_size = 0;
+    size_t heapsize, max_heapsize = 0;
     char *p;
     char *newp, *oldp;
 
@@ -768,13 +1068,70 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case MEMALIGN: /* mm_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign failed in eval_mm_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case CALLOC: /* mm_calloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].count * trace->ops[i].size;
+
+	    if ((p = mm_calloc(trace->ops[i].count, trace->ops[i].size)) == NULL)
+		app_error("mm_calloc failed in eval_mm_util");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+
+	    total_size += size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case ALLOC_BATCH: /* mm_malloc_batch */
+	    index = trace->ops[i].index;
+	    count = trace->ops[i].count;
+	    size = trace->ops[i].size;
+
+	    if (mm_malloc_batch(size, count, (void **)&trace->blocks[index]) != count)
+		app_error("mm_malloc_batch failed in eval_mm_util");
+	    for (j = 0; j < count; j++)
+		trace->block_sizes[index + j] = size;
+
+	    total_size += size * count;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+	case FREE_BATCH: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    count = trace->ops[i].count;
+
+	    for (j = 0; j < count; j++)
+		total_size -= trace->block_sizes[index + j];
+	    mm_free_batch((void **)&trace->blocks[index], count);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* the heap may shrink, keep its high water mark */
+	heapsize = mem_heapsize() + mem_mapsize();
+	max_heapsize = (heapsize > max_heapsize) ? heapsize : max_heapsize;
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    *final_heap = (double)(mem_heapsize() + mem_mapsize());
+    return ((double)max_total_size / (double)max_heapsize);
 }
 
 
@@ -820,6 +1177,32 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            if ((p = mm_memalign(trace->ops[i].align, trace->ops[i].size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            if ((p = mm_calloc(trace->ops[i].count, trace->ops[i].size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            if (mm_malloc_batch(trace->ops[i].size, trace->ops[i].count,
+				(void **)&trace->blocks[index]) != trace->ops[i].count)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            mm_free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+            break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -833,7 +1216,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, j, newsize;
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -861,6 +1244,39 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+        case MEMALIGN: /* posix_memalign */
+	    if (posix_memalign((void **)&p, trace->ops[i].align,
+			       trace->ops[i].size) != 0) {
+		malloc_error(tracenum, i, "libc posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    if ((p = calloc(trace->ops[i].count, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	/* libc has no batch calls, run a batch as single calls */
+        case ALLOC_BATCH: /* malloc */
+	    for (j = 0; j < trace->ops[i].count; j++) {
+		if ((p = malloc(trace->ops[i].size)) == NULL) {
+		    malloc_error(tracenum, i, "libc malloc failed");
+		    unix_error("System message");
+		}
+		trace->blocks[trace->ops[i].index + j] = p;
+	    }
+	    break;
+
+        case FREE_BATCH: /* free */
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[trace->ops[i].index + j]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -876,7 +1292,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -906,6 +1322,329 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+        case MEMALIGN: /* posix_memalign */
+	    index = trace->ops[i].index;
+	    if (posix_memalign((void **)&p, trace->ops[i].align,
+			       trace->ops[i].size) != 0)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    index = trace->ops[i].index;
+	    if ((p = calloc(trace->ops[i].count, trace->ops[i].size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case ALLOC_BATCH: /* malloc */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++)
+		if ((trace->blocks[index + j] = malloc(trace->ops[i].size)) == NULL)
+		    unix_error("malloc failed in eval_libc_speed");
+	    break;
+
+        case FREE_BATCH: /* free */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[index + j]);
+	    break;
+	}
+    }
+}
+
+/*****************************************************************
+ * Self-checks of the mm calls no trace makes. Each starts from an
+ * empty heap and reports what it finds wrong through api_error.
+ ****************************************************************/
+
+#define CHECK_HEAP  (1 << 20) /* cap of the heap check_heaps makes */
+#define CHECK_BLOCK 4000      /* bytes of each block that fills it */
+#define CHECK_CHUNK 4096      /* chunk of the regions check_regions makes */
+#define CHECK_OBJ   100       /* bytes of each object bumped off them */
+#define CHECK_OBJS  500       /* objects per region, a dozen chunks' worth */
+#define CHECK_ROUNDS 4        /* regions and pools made and destroyed in turn */
+#define CHECK_POOLS 3         /* pools check_pools makes */
+#define CHECK_GETS  2000      /* objects taken from each, many chunks' worth */
+
+/*
+ * check_heaps - Fill a heap from mm_heap_create to its cap and check that
+ *     its blocks stay out of the default heap and are counted by its own
+ *     stats only, that mm_free and mm_realloc find the heap of a block,
+ *     then that mm_heap_destroy gives its address space back
+ */
+static void check_heaps(void)
+{
+    mm_heap_t *heap;
+    mm_stats_t st, def0, def;
+    char **blocks;
+    char *p;
+    char *lo = mem_heap_lo();
+    char *hi = lo + MM_ARENAS * mem_heap_max();
+    size_t reserved;
+    int i, j, n, max = CHECK_HEAP / CHECK_BLOCK;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	api_error("mm_init", "mm_init failed.");
+	return;
+    }
+    mm_get_stats(&def0);
+    reserved = mem_reserved();
+    if ((heap = mm_heap_create(CHECK_HEAP)) == NULL) {
+	api_error("mm_heap_create", "mm_heap_create failed.");
+	return;
+    }
+    if ((blocks = malloc((max + 1) * sizeof(char *))) == NULL)
+	unix_error("malloc failed in check_heaps");
+
+    /* the heap must run out within its cap, not well before it */
+    for (n = 0; n <= max && (p = mm_heap_malloc(heap, CHECK_BLOCK)) != NULL; n++) {
+	if (p >= lo && p < hi)
+	    api_error("mm_heap_malloc", "Block lies in the default heap");
+	memset(p, n & 0xFF, CHECK_BLOCK);
+	blocks[n] = p;
+    }
+    if (n > max)
+	api_error("mm_heap_malloc", "Heap grew past its cap");
+    else if (n < max / 2)
+	api_error("mm_heap_malloc", "Heap ran out well below its cap");
+
+    mm_heap_stats(heap, &st);
+    if (st.heap_bytes > CHECK_HEAP || st.live_bytes < (size_t)n * CHECK_BLOCK)
+	api_error("mm_heap_stats", "Stats do not match the blocks of the heap");
+    mm_get_stats(&def);
+    if (def.heap_bytes != def0.heap_bytes)
+	api_error("mm_heap_stats", "Blocks of the heap counted in the default heap");
+
+    for (i = 0; i < n; i++) {
+	for (j = 0; j < CHECK_BLOCK; j++)
+	    if ((unsigned char)blocks[i][j] != (i & 0xFF)) {
+		api_error("mm_heap_malloc", "Block was overwritten");
+		break;
+	    }
+	if (i & 1)
+	    mm_free(blocks[i]);
+	else
+	    mm_heap_free(heap, blocks[i]);
+    }
+    mm_heap_stats(heap, &st);
+    if (st.live_bytes > (size_t)n * CHECK_BLOCK / 2)
+	api_error("mm_heap_free", "Freed blocks still counted live");
+
+    /* grown past the mmap threshold, the block must still stay in its heap */
+    if ((p = mm_heap_malloc(heap, CHECK_BLOCK)) == NULL)
+	api_error("mm_heap_malloc", "mm_heap_malloc failed.");
+    else if ((p = mm_realloc(p, CHECK_HEAP / 4)) == NULL)
+	api_error("mm_realloc", "mm_realloc failed on a block of a heap");
+    else {
+	mm_heap_stats(heap, &st);
+	if (st.live_bytes < CHECK_HEAP / 4)
+	    api_error("mm_realloc", "Block left its heap");
+	mm_free(p);
+    }
+
+    mm_heap_destroy(heap);
+    if (mem_reserved() != reserved)
+	api_error("mm_heap_destroy", "Heap kept its address space");
+    free(blocks);
+}
+
+/*
+ * check_regions - Bump objects off regions with small chunks: across
+ *     chunk boundaries, around an object larger than a chunk, and again
+ *     after mm_region_reset, which must start over in the first chunk.
+ *     Making and destroying the same region in turn must not grow the
+ *     heap, or mm_region_destroy kept chunks.
+ */
+static void check_regions(void)
+{
+    mm_region_t *r;
+    mm_stats_t st;
+    char *objs[CHECK_OBJS];
+    char *first, *big, *p;
+    size_t step = ALIGNMENT * ((CHECK_OBJ + ALIGNMENT - 1) / ALIGNMENT);
+    size_t heap = 0;
+    int i, j, round, chunks;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	api_error("mm_init", "mm_init failed.");
+	return;
+    }
+    for (round = 0; round < CHECK_ROUNDS; round++) {
+	if ((r = mm_region_create(CHECK_CHUNK)) == NULL) {
+	    api_error("mm_region_create", "mm_region_create failed.");
+	    return;
+	}
+
+	/* an oversized object gets a chunk of its own, bumping goes on */
+	first = mm_region_alloc(r, CHECK_OBJ);
+	big = mm_region_alloc(r, 3 * CHECK_CHUNK);
+	p = mm_region_alloc(r, CHECK_OBJ);
+	if (first == NULL || big == NULL || p == NULL) {
+	    api_error("mm_region_alloc", "mm_region_alloc failed.");
+	    mm_region_destroy(r);
+	    return;
+	}
+	if (p != first + step)
+	    api_error("mm_region_alloc", "Oversized object cut the chunk short");
+	memset(big, 0xA5, 3 * CHECK_CHUNK);
+
+	/* objects follow each other within a chunk */
+	for (i = 0, chunks = 1; i < CHECK_OBJS; i++) {
+	    if ((objs[i] = mm_region_alloc(r, CHECK_OBJ)) == NULL) {
+		api_error("mm_region_alloc", "mm_region_alloc failed.");
+		mm_region_destroy(r);
+		return;
+	    }
+	    if (!IS_ALIGNED(objs[i], ALIGNMENT))
+		api_error("mm_region_alloc", "Object not aligned");
+	    if (i > 0 && objs[i] != objs[i - 1] + step)
+		chunks++;
+	    memset(objs[i], i & 0xFF, CHECK_OBJ);
+	}
+	if (chunks < CHECK_OBJS * step / CHECK_CHUNK)
+	    api_error("mm_region_alloc", "Objects overlap the chunk boundaries");
+	for (i = 0; i < CHECK_OBJS; i++)
+	    for (j = 0; j < CHECK_OBJ; j++)
+		if ((unsigned char)objs[i][j] != (i & 0xFF)) {
+		    api_error("mm_region_alloc", "Object was overwritten");
+		    i = CHECK_OBJS;
+		    break;
+		}
+	for (j = 0; j < 3 * CHECK_CHUNK; j++)
+	    if ((unsigned char)big[j] != 0xA5) {
+		api_error("mm_region_alloc", "Oversized object was overwritten");
+		break;
+	    }
+
+	/* reset keeps the first chunk and starts over in it */
+	mm_region_reset(r);
+	if (mm_region_alloc(r, CHECK_OBJ) != first)
+	    api_error("mm_region_reset", "Region did not start over in its first chunk");
+	for (i = 0; i < CHECK_OBJS; i++)
+	    if (mm_region_alloc(r, CHECK_OBJ) == NULL) {
+		api_error("mm_region_alloc", "mm_region_alloc failed after reset.");
+		break;
+	    }
+	mm_region_destroy(r);
+
+	mm_get_stats(&st);
+	if (round == 0)
+	    heap = st.heap_bytes;
+	else if (st.heap_bytes > heap) {
+	    api_error("mm_region_destroy", "Chunks kept after the region was destroyed");
+	    break;
+	}
+    }
+}
+
+/*
+ * check_pools - Take objects from pools of a small, a 64-byte aligned and
+ *     a large object size, well past their first chunk, and check their
+ *     alignment, contents and the occupancy mm_get_stats reports. Objects
+ *     put back must be the next ones got, without carving new ones. The
+ *     heap may grow past the first round of pools by a chunk per pool at
+ *     most, a bound that holds with deferred coalescing as well, and
+ *     not by every chunk a round takes.
+ */
+static void check_pools(void)
+{
+    static const size_t sizes[CHECK_POOLS] = {24, 40, 20000};
+    static const size_t aligns[CHECK_POOLS] = {0, 64, 0};
+    static char *objs[CHECK_POOLS][CHECK_GETS];
+    mm_pool_t *pools[CHECK_POOLS];
+    mm_stats_t st;
+    size_t bytes = 0, prev, slack = 0, heap = 0, align, j;
+    unsigned long objects;
+    int got[CHECK_POOLS];
+    int i, k, n, round, misaligned;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	api_error("mm_init", "mm_init failed.");
+	return;
+    }
+    for (round = 0; round < CHECK_ROUNDS; round++) {
+	for (k = 0; k < CHECK_POOLS; k++)
+	    if ((pools[k] = mm_pool_create(sizes[k], aligns[k])) == NULL) {
+		api_error("mm_pool_create", "mm_pool_create failed.");
+		while (--k >= 0)
+		    mm_pool_destroy(pools[k]);
+		return;
+	    }
+
+	/* the large objects only need a few chunks */
+	for (k = 0, n = 0, prev = 0; k < CHECK_POOLS; k++) {
+	    align = aligns[k] ? aligns[k] : ALIGNMENT;
+	    got[k] = sizes[k] > 1000 ? CHECK_GETS / 50 : CHECK_GETS;
+	    misaligned = 0;
+	    for (i = 0; i < got[k]; i++, n++) {
+		if ((objs[k][i] = mm_pool_get(pools[k])) == NULL) {
+		    api_error("mm_pool_get", "mm_pool_get failed.");
+		    got[k] = i;
+		    break;
+		}
+		misaligned += !IS_ALIGNED(objs[k][i], align);
+		memset(objs[k][i], (k + i) & 0xFF, sizes[k]);
+		if (i == 0) {
+		    mm_get_stats(&st);
+		    bytes = st.pool_bytes;
+		    if (round == 0)
+			slack += bytes - prev; /* the first chunk of the pool */
+		}
+	    }
+	    if (misaligned > 0)
+		api_error("mm_pool_get", "Objects not aligned");
+	    mm_get_stats(&st);
+	    if (st.pool_bytes <= bytes)
+		api_error("mm_pool_get", "Pool did not grow past its first chunk");
+	    prev = st.pool_bytes;
+	}
+	for (k = 0; k < CHECK_POOLS; k++)
+	    for (i = 0; i < got[k]; i++)
+		for (j = 0; j < sizes[k]; j++)
+		    if ((unsigned char)objs[k][i][j] != ((k + i) & 0xFF)) {
+			api_error("mm_pool_get", "Object was overwritten");
+			i = got[k];
+			break;
+		    }
+
+	mm_get_stats(&st);
+	if (st.pools != CHECK_POOLS || st.pool_in_use != n ||
+	    st.pool_objects != n || st.pool_bytes > st.live_bytes)
+	    api_error("mm_get_stats", "Pool stats do not match the objects taken");
+	if (verbose > 1 && round == 0)
+	    print_mm_stats();
+
+	/* put half back, the free list hands them out again last in first */
+	objects = st.pool_objects;
+	for (i = 0; i < CHECK_GETS / 2; i++)
+	    mm_pool_put(pools[0], objs[0][i]);
+	mm_get_stats(&st);
+	if (st.pool_in_use != n - CHECK_GETS / 2)
+	    api_error("mm_pool_put", "Put objects still counted in use");
+	for (i = CHECK_GETS / 2 - 1; i >= 0; i--)
+	    if (mm_pool_get(pools[0]) != objs[0][i]) {
+		api_error("mm_pool_get", "Put object not reused");
+		break;
+	    }
+	mm_get_stats(&st);
+	if (st.pool_objects != objects || st.pool_in_use != n)
+	    api_error("mm_pool_get", "Objects carved while put ones were free");
+
+	for (k = 0; k < CHECK_POOLS; k++)
+	    mm_pool_destroy(pools[k]);
+	mm_get_stats(&st);
+	if (st.pools != 0 || st.pool_bytes != 0)
+	    api_error("mm_pool_destroy", "Destroyed pools still counted");
+	if (round == 0)
+	    heap = st.heap_bytes + slack;
+	else if (st.heap_bytes > heap) {
+	    api_error("mm_pool_destroy", "Chunks kept after the pools were destroyed");
+	    break;
 	}
     }
 }
@@ -915,6 +1654,66 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * print_mm_stats - prints the allocator's counters for the last run
+ */
+static void print_mm_stats(void)
+{
+    mm_stats_t st;
+
+    mm_get_stats(&st);
+    printf("  extends %lu, splits %lu, coalesce %lu/%lu/%lu/%lu, "
+	   "realloc in place %lu moved %lu, tree height %d\n",
+	   st.extends, st.splits, st.coalesce[0], st.coalesce[1],
+	   st.coalesce[2], st.coalesce[3], st.realloc_inplace,
+	   st.realloc_moved, st.tree_height);
+    if (st.pools > 0)
+	printf("  pools %lu, %lu of %lu objects in use, %lu bytes\n",
+	       st.pools, st.pool_in_use, st.pool_objects,
+	       (unsigned long)st.pool_bytes);
+    printf("  heap %lu bytes, committed %lu of %lu reserved, mapped %lu\n",
+	   (unsigned long)mem_heapsize(), (unsigned long)mem_committed(),
+	   (unsigned long)mem_reserved(), (unsigned long)mem_mapsize());
+}
+
+#if MM_PROFILE
+/*
+ * print_hist - prints the mean and the non-empty buckets of a histogram
+ */
+static void print_hist(char *name, mm_hist_t *h)
+{
+    int b;
+
+    printf("  %-17s n %8lu  mean %8.1f |", name, h->n,
+	   h->n ? (double)h->sum / h->n : 0.0);
+    for (b = 0; b < MM_HIST_BUCKETS; b++) {
+	if (h->bucket[b] == 0)
+	    continue;
+	if (b == 0)
+	    printf(" 0:%lu", h->bucket[b]);
+	else
+	    printf(" <%lu:%lu", 1UL << b, h->bucket[b]);
+    }
+    printf("\n");
+}
+
+/*
+ * print_profile - prints the histograms of the timed runs of a trace
+ */
+static void print_profile(void)
+{
+    mm_profile_t prof;
+
+    mm_get_profile(&prof);
+    print_hist("malloc cycles", &prof.malloc_cycles);
+    print_hist("free cycles", &prof.free_cycles);
+    print_hist("realloc cycles", &prof.realloc_cycles);
+    print_hist("search nodes", &prof.search_nodes);
+    print_hist("insert rotations", &prof.insert_rotations);
+    print_hist("delete rotations", &prof.delete_rotations);
+}
+#endif
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -926,14 +1725,15 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%11s%8s%10s%6s\n", 
+	   "trace", " valid", "util", "final heap", "ops", "secs", "Kops");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%11.0f%8.0f%10.6f%6.0f\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
+		   stats[i].heap,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
@@ -942,31 +1742,34 @@ static void printresults(int n, stats_t *stats)
 	    util += stats[i].util;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%11s%8s%10s%6s\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
+		   "-",
 		   "-");
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%11s%8.0f%10.6f%6.0f\n", 
 	       "Total       ",
 	       (util/n)*100.0,
+	       "",
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%11s%8s%10s%6s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
+	       "-", 
 	       "-");
     }
 
@@ -999,18 +1802,31 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * api_error - Report an error found by a self-check of an mm call
+ */
+void api_error(char *call, char *msg)
+{
+    errors++;
+    printf("ERROR [%s]: %s\n", call, msg);
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValP] [-f <file>] [-t <dir>] [-H <MB>] [-s <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <MB>    Heap size of each arena, default %d MB.\n",
+	    MAX_HEAP >> 20);
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-P         Time mm malloc on huge heap pages as well.\n");
+    fprintf(stderr, "\t-s <n>     Time <n> interleaved copies of each trace.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE          /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +15,223 @@
 #include "memlib.h"
 #include "config.h"
 
+/* 
+ * The region is split in MM_ARENAS slices of mem_heap_max() bytes, each
+ * with its own brk, so every arena of the allocator grows a contiguous
+ * heap. The slice size is MAX_HEAP unless mem_set_heap_max changes it.
+ * mem_sbrk works on the first slice. The region starts out zeroed;
+ * memory below a slice's dirty mark has been handed out before and may
+ * hold anything.
+ *
+ * The region is only reserved address space, mapped PROT_NONE. A slice
+ * commits memory in MEM_COMMIT steps as its brk grows past the committed
+ * end. When the brk moves down, the steps more than DECOMMIT_THRESHOLD
+ * above it go back to the OS; the rest stays for the heap to grow into
+ * again without a fault. mem_reset_brk keeps what is committed for the
+ * next heap.
+ *
+ * mem_set_heap_pages asks for huge pages under the region: explicit
+ * MAP_HUGETLB pages when the system pool can reserve the whole region,
+ * transparent ones through madvise(MADV_HUGEPAGE) otherwise. The commit
+ * granule is then a huge page.
+ *
+ * Slices past the MM_ARENAS of the region are reserved one at a time by
+ * mem_arena_create, each a mapping of its own and of its own size, for
+ * heaps that must stay apart from the default one.
+ */
+#define MEM_SLICES (MM_ARENAS + MM_HEAPS)
+#define MEM_COMMIT (64*1024)         /* commit granule, a page multiple */
+#define COMMIT_UP(p) ((char *)(((size_t)(p) + mem_granule - 1) & ~(mem_granule - 1)))
+
+/*
+ * Besides the brk heaps there are page-granular mappings, taken from and
+ * given back to the OS right away. A hash table of them, keyed by start
+ * address and doubled as it fills, lets the driver tell whether a payload
+ * lies in one. Any thread may map or unmap, so it is kept under a spin
+ * lock; a mapping costs a system call anyway.
+ */
+#define MAPS_MIN 64                  /* smallest table, a power of two */
+#define MAP_HASH(p) (((size_t)(p) >> 12) * 2654435761u)
+#define MAP_BUSY ((char *)-1)        /* slice being reserved */
+#define MAP_GONE ((char *)-1)        /* table slot of a removed mapping */
+
+typedef struct {
+    char *addr;                  /* start of the mapping, NULL if unused */
+    size_t size;                 /* bytes mapped */
+} map_t;
+
+static char *mem_reserve(size_t size);
+static int mem_commit_to(int arena, char *end);
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_max_heap = MAX_HEAP; /* bytes per slice */
+static size_t mem_page;      /* huge page size asked for, 0 for none */
+static size_t mem_granule = MEM_COMMIT; /* bytes committed at a time */
+static int mem_hugetlb;      /* region is on explicit huge pages */
+static char *mem_lo[MEM_SLICES]; /* first byte of each slice, NULL if unused */
+static char *mem_end[MEM_SLICES]; /* byte past the end of each slice */
+static char *mem_brk[MEM_SLICES]; /* points to last byte of each slice's heap */
+static char *mem_dirty[MEM_SLICES]; /* highest brk of each slice so far */
+static char *mem_commit[MEM_SLICES]; /* end of each slice's committed memory */
+static size_t mem_committed_bytes; /* sum over the slices */
+static map_t *mem_maps;          /* mappings handed out by mem_map */
+static size_t mem_maps_size;     /* slots of the table */
+static size_t mem_maps_used;     /* slots ever filled since the last rehash */
+static size_t mem_maps_live;     /* mappings in the table */
+static int mem_maps_lock;
+static size_t mem_mapped_bytes;  /* sum of their sizes */
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    char *p;
+    size_t size;
+    int i;
+
+    /* reserve the address space we will use to model the available VM */
+    mem_granule = mem_page > MEM_COMMIT ? mem_page : MEM_COMMIT;
+    mem_max_heap = (size_t)COMMIT_UP(mem_max_heap);
+    size = MM_ARENAS * mem_max_heap;
+    mem_hugetlb = 0;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    if (mem_page > 0) {
+	/* no MAP_NORESERVE: fail here rather than fault on an empty pool */
+	p = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+		 (__builtin_ctzl(mem_page) << MAP_HUGE_SHIFT), -1, 0);
+	if (p != MAP_FAILED) {
+	    mem_hugetlb = 1;
+	    mem_start_brk = p;
+	}
+    }
+#endif
+    if (!mem_hugetlb && (mem_start_brk = mem_reserve(size)) == NULL) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    for (i = 0; i < MM_ARENAS; i++) {
+	mem_lo[i] = mem_start_brk + mem_max_heap * i;
+	mem_end[i] = mem_lo[i] + mem_max_heap;
+    }
+    mem_reset_brk();                          /* heap is empty initially */
+    for (i = 0; i < MM_ARENAS; i++)
+	mem_dirty[i] = mem_commit[i] = mem_brk[i];
+    mem_committed_bytes = 0;
+}
+
+/*
+ * mem_reserve - reserve size bytes of address space, a granule
+ *    multiple, starting on a granule. Returns NULL on failure.
+ */
+static char *mem_reserve(size_t size)
+{
+    char *p, *start;
+
+    p = mmap(NULL, size + mem_granule, PROT_NONE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+
+    /* trim the slack on both sides */
+    start = COMMIT_UP(p);
+    if (start > p)
+	munmap(p, start - p);
+    munmap(start + size, p + mem_granule - start);
+#ifdef MADV_HUGEPAGE
+    if (mem_page > 0)
+	madvise(start, size, MADV_HUGEPAGE);
+#endif
+    return start;
+}
+
+/*
+ * mem_arena_create - reserve a slice of size bytes outside the region,
+ *    with a brk of its own. Returns its number or -1 when the address
+ *    space or the MM_HEAPS extra slices run out.
+ */
+int mem_arena_create(size_t size)
+{
+    char *p;
+    int i;
+
+    size = (size_t)COMMIT_UP(size);
+    for (i = MM_ARENAS; i < MEM_SLICES; i++)
+	if (__atomic_load_n(&mem_lo[i], __ATOMIC_RELAXED) == NULL &&
+	    __sync_bool_compare_and_swap(&mem_lo[i], NULL, MAP_BUSY)) {
+	    if ((p = mem_reserve(size)) == NULL) {
+		__atomic_store_n(&mem_lo[i], NULL, __ATOMIC_RELEASE);
+		return -1;
+	    }
+	    mem_end[i] = p + size;
+	    mem_brk[i] = mem_dirty[i] = mem_commit[i] = p;
+	    __atomic_store_n(&mem_lo[i], p, __ATOMIC_RELEASE);
+	    return i;
+	}
+    errno = ENOMEM;
+    return -1;
+}
+
+/*
+ * mem_arena_destroy - give a slice from mem_arena_create back to the OS
+ */
+void mem_arena_destroy(int arena)
+{
+    __sync_fetch_and_sub(&mem_committed_bytes, mem_commit[arena] - mem_lo[arena]);
+    munmap(mem_lo[arena], mem_end[arena] - mem_lo[arena]);
+    __atomic_store_n(&mem_lo[arena], NULL, __ATOMIC_RELEASE);
+}
+
+/*
+ * mem_arena_max - return the bytes of slice arena
+ */
+size_t mem_arena_max(int arena)
+{
+    return mem_end[arena] - mem_lo[arena];
+}
+
+/*
+ * mem_set_heap_max - set the bytes of each slice, before mem_init. It is
+ *    rounded up to the commit granule.
+ */
+void mem_set_heap_max(size_t size)
+{
+    mem_max_heap = size;
+}
+
+/*
+ * mem_set_heap_pages - back the region with pages of size bytes, a
+ *    power of two, before mem_init. 0 goes back to the system page.
+ */
+void mem_set_heap_pages(size_t size)
+{
+    mem_page = size;
+}
+
+/*
+ * mem_heap_pagesize - return the page size the region grows by
+ */
+size_t mem_heap_pagesize()
+{
+    return mem_page > 0 ? mem_page : mem_pagesize();
+}
+
+/*
+ * mem_heap_hugetlb - are the huge pages explicit rather than transparent?
+ */
+int mem_heap_hugetlb()
+{
+    return mem_hugetlb;
+}
+
+/*
+ * mem_heap_max - return the bytes of each slice
+ */
+size_t mem_heap_max()
+{
+    return mem_max_heap;
 }
 
 /* 
@@ -39,35 +239,102 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    int i;
+
+    for (i = MM_ARENAS; i < MEM_SLICES; i++)
+	if (mem_lo[i] != NULL)
+	    mem_arena_destroy(i);
+    munmap(mem_start_brk, MM_ARENAS * mem_max_heap);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and drop all mappings
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    size_t i;
+
+    for (i = 0; i < MM_ARENAS; i++)
+	mem_brk[i] = mem_lo[i];
+    for (i = 0; i < mem_maps_size; i++)
+	if (mem_maps[i].addr != NULL && mem_maps[i].addr != MAP_GONE)
+	    munmap(mem_maps[i].addr, mem_maps[i].size);
+    free(mem_maps);
+    mem_maps = NULL;
+    mem_maps_size = mem_maps_used = mem_maps_live = 0;
+    mem_mapped_bytes = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap and returns the old brk.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_sbrk_arena(0, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+/*
+ * mem_sbrk_arena - mem_sbrk on the heap of slice arena. Calls on
+ *    different slices may run concurrently.
+ */
+void *mem_sbrk_arena(int arena, intptr_t incr)
+{
+    char *old_brk = mem_brk[arena];
+    char *min_addr = mem_lo[arena];
+    char *max_addr = mem_end[arena];
+
+    if ((old_brk + incr) < min_addr) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap start...\n");
+	return (void *)-1;
+    }
+    if ((old_brk + incr) > max_addr) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    if (mem_brk[arena] + incr > mem_commit[arena]) {
+	if (mem_commit_to(arena, COMMIT_UP(mem_brk[arena] + incr)) < 0) {
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+	    return (void *)-1;
+	}
+    } else if (DECOMMIT_THRESHOLD > 0 && incr < 0 &&
+	       COMMIT_UP(mem_brk[arena] + incr + DECOMMIT_THRESHOLD) < mem_commit[arena])
+	mem_commit_to(arena, COMMIT_UP(mem_brk[arena] + incr + DECOMMIT_THRESHOLD));
+    mem_brk[arena] += incr;
+    if (mem_brk[arena] > mem_dirty[arena])
+	mem_dirty[arena] = mem_brk[arena];
     return (void *)old_brk;
 }
 
+/*
+ * mem_commit_to - move the committed end of slice arena to end, a
+ *    granule boundary. Memory given back reads as zero when committed
+ *    again, so the dirty mark comes down with it.
+ */
+static int mem_commit_to(int arena, char *end)
+{
+    char *commit = mem_commit[arena];
+
+    if (end > commit) {
+	if (mprotect(commit, end - commit, PROT_READ | PROT_WRITE) < 0)
+	    return -1;
+	__sync_fetch_and_add(&mem_committed_bytes, end - commit);
+    } else {
+	if (madvise(end, commit - end, MADV_DONTNEED) < 0 ||
+	    mprotect(end, commit - end, PROT_NONE) < 0)
+	    return -1;
+	__sync_fetch_and_sub(&mem_committed_bytes, commit - end);
+	if (mem_dirty[arena] > end)
+	    mem_dirty[arena] = end;
+    }
+    mem_commit[arena] = end;
+    return 0;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -81,15 +348,244 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    char *hi = mem_start_brk;
+    int i;
+
+    /* the top of the highest slice in use */
+    for (i = 0; i < MM_ARENAS; i++)
+	if (mem_brk[i] > mem_lo[i])
+	    hi = mem_brk[i];
+    return (void *)(hi - 1);
+}
+
+/*
+ * mem_committed() - returns the bytes of the region backed by memory
+ */
+size_t mem_committed()
+{
+    return mem_committed_bytes;
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_reserved() - returns the bytes of address space the region and
+ *    the slices of mem_arena_create hold
+ */
+size_t mem_reserved()
+{
+    size_t size = MM_ARENAS * mem_max_heap;
+    char *lo;
+    int i;
+
+    for (i = MM_ARENAS; i < MEM_SLICES; i++) {
+	lo = __atomic_load_n(&mem_lo[i], __ATOMIC_ACQUIRE);
+	if (lo != NULL && lo != MAP_BUSY)
+	    size += mem_end[i] - lo;
+    }
+    return size;
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes, summed over the slices
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < MM_ARENAS; i++)
+	size += mem_brk[i] - mem_lo[i];
+    return size;
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of slice arena
+ */
+void *mem_arena_lo(int arena)
+{
+    return (void *)mem_lo[arena];
+}
+
+/*
+ * mem_arena_hi - return address of the last heap byte of slice arena
+ */
+void *mem_arena_hi(int arena)
+{
+    return (void *)(mem_brk[arena] - 1);
+}
+
+/*
+ * mem_arena_clean - return the address from which slice arena has never
+ *    been handed out, the memory there is still zero
+ */
+void *mem_arena_clean(int arena)
+{
+    return (void *)mem_dirty[arena];
+}
+
+static void mem_maps_acquire(void)
+{
+    while (__sync_lock_test_and_set(&mem_maps_lock, 1))
+	while (__atomic_load_n(&mem_maps_lock, __ATOMIC_RELAXED))
+	    ;
+}
+
+static void mem_maps_release(void)
+{
+    __sync_lock_release(&mem_maps_lock);
+}
+
+/*
+ * mem_maps_grow - rehash the live mappings into a table they fill at most
+ *    a quarter of, dropping the slots of removed ones. Called with the lock.
+ */
+static int mem_maps_grow(void)
+{
+    map_t *maps;
+    size_t size, i, h;
+
+    for (size = MAPS_MIN; size < 4 * (mem_maps_live + 1); size *= 2)
+	;
+    if ((maps = calloc(size, sizeof(map_t))) == NULL)
+	return -1;
+    for (i = 0; i < mem_maps_size; i++)
+	if (mem_maps[i].addr != NULL && mem_maps[i].addr != MAP_GONE) {
+	    for (h = MAP_HASH(mem_maps[i].addr); maps[h & (size - 1)].addr != NULL; h++)
+		;
+	    maps[h & (size - 1)] = mem_maps[i];
+	}
+    free(mem_maps);
+    mem_maps = maps;
+    mem_maps_size = size;
+    mem_maps_used = mem_maps_live;
+    return 0;
+}
+
+/*
+ * mem_add_map - enter the mapping at p in the table, growing it once
+ *    half its slots have been filled
+ */
+static int mem_add_map(char *p, size_t size)
+{
+    size_t h;
+
+    mem_maps_acquire();
+    if (2 * (mem_maps_used + 1) > mem_maps_size && mem_maps_grow() < 0) {
+	mem_maps_release();
+	return -1;
+    }
+    for (h = MAP_HASH(p); ; h++) {
+	map_t *m = &mem_maps[h & (mem_maps_size - 1)];
+
+	if (m->addr == NULL || m->addr == MAP_GONE) {
+	    if (m->addr == NULL)
+		mem_maps_used++;
+	    m->addr = p;
+	    m->size = size;
+	    break;
+	}
+    }
+    mem_maps_live++;
+    __sync_fetch_and_add(&mem_mapped_bytes, size);
+    mem_maps_release();
+    return 0;
+}
+
+/*
+ * mem_take_map - remove the mapping at p from the table
+ */
+static void mem_take_map(char *p)
+{
+    size_t h;
+
+    mem_maps_acquire();
+    for (h = MAP_HASH(p); mem_maps_size > 0; h++) {
+	map_t *m = &mem_maps[h & (mem_maps_size - 1)];
+
+	if (m->addr == NULL)
+	    break;
+	if (m->addr == p) {
+	    m->addr = MAP_GONE;
+	    mem_maps_live--;
+	    __sync_fetch_and_sub(&mem_mapped_bytes, m->size);
+	    break;
+	}
+    }
+    mem_maps_release();
+}
+
+/*
+ * mem_map - map size bytes, a multiple of the page size, outside the
+ *    heap. Returns the start of the mapping or NULL.
+ */
+void *mem_map(size_t size)
+{
+    char *p;
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+	return NULL;
+    if (mem_add_map(p, size) < 0) {
+	munmap(p, size);
+	errno = ENOMEM;
+	return NULL;
+    }
+    return p;
+}
+
+/*
+ * mem_unmap - give the mapping at ptr back to the OS
+ */
+void mem_unmap(void *ptr, size_t size)
+{
+    /* drop it from the table first, the OS may hand the address out again */
+    mem_take_map(ptr);
+    munmap(ptr, size);
+}
+
+/*
+ * mem_remap - resize the mapping at ptr from old_size to new_size bytes.
+ *    The pages move rather than the bytes, so nothing is copied. Returns
+ *    the possibly moved start of the mapping or NULL.
+ */
+void *mem_remap(void *ptr, size_t old_size, size_t new_size)
+{
+    char *p;
+
+    mem_take_map(ptr);
+    p = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED) {
+	mem_add_map(ptr, old_size);
+	return NULL;
+    }
+    mem_add_map(p, new_size);    /* the slot just freed leaves room */
+    return p;
+}
+
+/*
+ * mem_mapped - is [lo, hi] inside one mapping?
+ */
+int mem_mapped(void *lo, void *hi)
+{
+    char *addr;
+    size_t i;
+    int found = 0;
+
+    mem_maps_acquire();
+    for (i = 0; i < mem_maps_size && !found; i++) {
+	addr = mem_maps[i].addr;
+	found = addr != NULL && addr != MAP_GONE && (char *)lo >= addr &&
+	    (char *)hi < addr + mem_maps[i].size;
+    }
+    mem_maps_release();
+    return found;
+}
+
+/*
+ * mem_mapsize() - returns the bytes currently mapped by mem_map
+ */
+size_t mem_mapsize()
+{
+    return __atomic_load_n(&mem_mapped_bytes, __ATOMIC_RELAXED);
 }
 
 /*
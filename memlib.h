@@ -1,11 +1,31 @@
 #include <unistd.h>
+#include <stdint.h>
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void mem_set_heap_max(size_t size);
+size_t mem_heap_max(void);
+void mem_set_heap_pages(size_t size);
+size_t mem_heap_pagesize(void);
+int mem_heap_hugetlb(void);
+void *mem_sbrk(intptr_t incr);
+void *mem_sbrk_arena(int arena, intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_arena_lo(int arena);
+void *mem_arena_hi(int arena);
+void *mem_arena_clean(int arena);
+int mem_arena_create(size_t size);
+void mem_arena_destroy(int arena);
+size_t mem_arena_max(int arena);
 size_t mem_heapsize(void);
+size_t mem_committed(void);
+size_t mem_reserved(void);
+void *mem_map(size_t size);
+void mem_unmap(void *ptr, size_t size);
+void *mem_remap(void *ptr, size_t old_size, size_t new_size);
+int mem_mapped(void *lo, void *hi);
+size_t mem_mapsize(void);
 size_t mem_pagesize(void);
 
@@ -2,15 +2,21 @@
 * mm-implicit.c -  Simple allocator based on implicit free lists,
 *                  first fit placement, and boundary tag coalescing.
 *
-* Each block has header and footer of the form:
+* Each block has a 32-bit header, and free blocks also a footer, of the
+* form:
 *
 *      31                     3  2  1  0
 *      -----------------------------------
-*     | s  s  s  s  ... s  s  s  0  0  a/f
+*     | s  s  s  s  ... s  s  s pa  c  a/f
 *      -----------------------------------
 *
-* where s are the meaningful size bits and a/f is set
-* iff the block is allocated. The list has the following form:
+* where s are the meaningful size bits, a/f is set iff the block is
+* allocated, c is the red/black color of a free block in the tree and
+* pa is set iff the previous block is allocated. Allocated blocks have
+* no footer, so the footer of the previous block is only read when pa
+* says it is free. Payloads are ALIGNMENT aligned, 8 bytes in the 32-bit
+* build and 16 in a native LP64 one, and block sizes are multiples of it.
+* The list has the following form:
 *
 * begin                                                          end
 * heap                                                           heap
@@ -27,8 +33,14 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
+#if MM_PROFILE && !defined(__i386__) && !defined(__x86_64__)
+#include <time.h>
+#endif
 //#define VERBOSE 1
 //#define checkheap  
 //#define printre
@@ -51,93 +63,1528 @@ team_t team = {
 #define WSIZE       4       /* word size (bytes) */  
 #define DSIZE       8       /* doubleword size (bytes) */
 #define CHUNKSIZE  (1<<12)  /* initial heap size (bytes) */
-#define OVERHEAD    8       /* overhead of header and footer (bytes) */
-#define POINTER_OVERHEAD   24   /* overhead of pointer: parent, left and right */
+#define OVERHEAD    8       /* overhead of header and footer of a free block (bytes) */
+#define POINTER_OVERHEAD   (NLINKS*LSIZE)   /* overhead of pointer: (parent,) left, right and same size list */
 #define TREE_ROOT 8 /* tree root pointer at heap_listp */
+#define MIN_BLKSIZE (ALIGNMENT * ((OVERHEAD + POINTER_OVERHEAD + ALIGNMENT - 1) / ALIGNMENT)) /* smallest block that can sit in the tree */
+#define MAX_BLKSIZE ((size_t)(UINT32_MAX & ~0x7)) /* largest block a 32-bit header holds */
 typedef unsigned long long address_t;
 typedef unsigned long long block_t;
+#if COMPACT_LINKS
+/* tree links are offsets from heap_start in DSIZE units, 0 is NULL */
+typedef unsigned int link_t;
+#define LSIZE       4       /* link size (bytes) */
+#define COMPACT_HEAP_MAX ((unsigned long long)DSIZE << 32) /* largest heap links can reach */
+#else
+typedef block_t link_t;
+#define LSIZE       DSIZE   /* link size (bytes) */
+#endif
 //typedef unsigned int size_t;
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+
+#define PREV_ALLOC  0x4     /* header bit: previous block is allocated */
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
-/* Read and write a word at address p */
-#define GET(p)       (*(size_t *)(p))
-#define GET_ADDRESS(p) ((block_t *)(p))
-#define PUT(p, val)  (*(size_t *)(p) = (val))  
-#define PUT_ADDRESS(p,val) (*(block_t *)(p) = (block_t)(val)) 
+/* Read and write a word at address p, headers are 32 bits on any build */
+#define GET(p)       (*(uint32_t *)(p))
+#define PUT(p, val)  (*(uint32_t *)(p) = (uint32_t)(val))
+
+/* Read and write a tree link at address p */
+#if COMPACT_LINKS
+#define GET_LINK(p) (*(link_t *)(p) ? (block_t *)(arena->heap_start + ((size_t)*(link_t *)(p) << 3)) : NULL)
+#define PUT_ADDRESS(p,val) put_link((p), (val))
+#else
+#define GET_LINK(p) ((block_t *)(unsigned long)*(link_t *)(p))
+#define PUT_ADDRESS(p,val) (*(link_t *)(p) = (link_t)(unsigned long)(val))
+#endif
 //#define PUT_ADDRESS1(p,val) ((block_t)(p) = (block_t)(val)) 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
-/* you can only use GET_SIZE, since block in tree must be freed */
-#define GET_SIZE_ALLOC(p) (GET_SIZE(p)|GET_ALLOC(p))
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+/* everything but the color, so recoloring keeps the prev-alloc bit */
+#define GET_SIZE_ALLOC(p) (GET(p) & ~0x2)
+#if MM_ARENAS > 1 && THREAD_CACHE
+/* atomic, the thread cache reads the size of a live block without a lock */
+#define SET_PREV_ALLOC(bp) __sync_fetch_and_or((uint32_t *)HDRP(bp), PREV_ALLOC)
+#define CLR_PREV_ALLOC(bp) __sync_fetch_and_and((uint32_t *)HDRP(bp), ~PREV_ALLOC)
+#else
+#define SET_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) & ~PREV_ALLOC)
+#endif
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)  
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks,
+   PREV_BLKP only when the previous block is free */
 #define NEXT_BLKP(bp) ((block_t*) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE))))
 #define PREV_BLKP(bp) ((block_t*) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE))))
 #define IS_RED(p) ((GET(HDRP(p))>>1)&0x1)
 #define RED 1
 #define BLACK 0
-#define PARENT_BLKP(bp)   ((block_t *)((char* )(bp)))
-#define LEFT_BLKP(bp)  ((char* )(bp)+DSIZE)
-#define RIGHT_BLKP(bp) ((block_t*)((char* )(bp)+2*DSIZE))
-#define PARENT_BLK(bp)   (*(block_t*)((char *)(bp)))
-#define LEFT_BLK(bp)  (*(block_t*)((((char*)(bp))+DSIZE)))
-#define RIGHT_BLK(bp) (*(block_t*)((((char*)(bp))+2*DSIZE)))
+#if FREE_INDEX == FREE_INDEX_TLSF
+/* a free block sits on one doubly linked list of the two-level index */
+#define NLINKS 2
+#define NEXT_FREEP(bp) ((char* )(bp))
+#define PREV_FREEP(bp) ((char* )(bp)+LSIZE)
+#define NEXT_FREE(bp) GET_LINK(NEXT_FREEP(bp))
+#define PREV_FREE(bp) GET_LINK(PREV_FREEP(bp))
+#define TLSF_SL_LOG2 4      /* second level lists per power of two, log2 */
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_SMALL (TLSF_SL_COUNT * DSIZE) /* below this, one list per DSIZE */
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + 3)   /* log2 of TLSF_SMALL */
+#define TLSF_FL_COUNT (32 - TLSF_FL_SHIFT + 1) /* block sizes fit in 32 bits */
+#elif TOPDOWN_TREE
+/* no parent link, the tree is only ever walked down from the root */
+#define NLINKS 3
+#define LEFT_BLKP(bp)  ((char* )(bp))
+#define RIGHT_BLKP(bp) ((char* )(bp)+LSIZE)
+#define NEXT_DUP_BLKP(bp) ((char* )(bp)+2*LSIZE)
+#else
+#define NLINKS 4
+#define PARENT_BLKP(bp)   ((char* )(bp))
+#define LEFT_BLKP(bp)  ((char* )(bp)+LSIZE)
+#define RIGHT_BLKP(bp) ((char* )(bp)+2*LSIZE)
+#define NEXT_DUP_BLKP(bp) ((char* )(bp)+3*LSIZE)
+#define PARENT_BLK(bp)   GET_LINK(PARENT_BLKP(bp))
+#endif
+#if FREE_INDEX == FREE_INDEX_RBTREE
+#if TREE_FOREST
+/* one tree per power of two of the block size, rooted outside the heap */
+#define FOREST_CLASSES 32
+#define FOREST_CLASS(size) (31 - __builtin_clz((unsigned int)(size)))
+#define FOREST_ROOTP(cls) ((char *)arena->forest_roots[cls] + LSIZE)
+#define ROOTP arena->tree_rootp
+#elif TOPDOWN_TREE
+/* the prologue is the false root of the top-down walks, root on its right */
+#define ROOTP RIGHT_BLKP(arena->heap_listp)
+#else
+#define ROOTP PARENT_BLKP(arena->heap_listp)
+#endif
+/* false root of the top-down walks, the tree root is its right link */
+#define TREE_HEAD ((block_t *)(ROOTP - LSIZE))
+#define LEFT_BLK(bp)  GET_LINK(LEFT_BLKP(bp))
+#define RIGHT_BLK(bp) GET_LINK(RIGHT_BLKP(bp))
+/*
+* Each tree node is the only one of its size in the tree; the other free
+* blocks of that size hang off it in a doubly linked list. List members
+* carry DUP_MARK in the first link slot and their prev link in the second.
+*/
+#define NEXT_DUP_BLK(bp) GET_LINK(NEXT_DUP_BLKP(bp))
+#define PREV_DUP_BLKP(bp) ((char* )(bp)+LSIZE)
+#define PREV_DUP_BLK(bp) GET_LINK(PREV_DUP_BLKP(bp))
+#define DUP_MARK ((link_t)~0)
+#define SET_DUP(bp) (*(link_t *)(bp) = DUP_MARK)
+#define IS_DUP(bp) (*(link_t *)(bp) == DUP_MARK)
+#endif
+
+/* Slab pages for small requests, in front of the tree */
+#define SLAB_SIZE   (1<<12) /* bytes per slab page, slabs are page aligned */
+#define SLAB_MAX    128     /* largest request served from a slab */
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT) /* one class per ALIGNMENT step */
+#define SLAB_MAPWORDS 16    /* bitmap words, enough for SLAB_SIZE / 8 objects */
+#define SLAB_CLASS(size) (((size) + ALIGNMENT - 1) / ALIGNMENT - 1)
+#define SLAB_HDRSIZE  (ALIGNMENT * ((sizeof(slab_t) + ALIGNMENT - 1) / ALIGNMENT))
+#define SLAB_OF(p)    ((slab_t *)((unsigned long)(p) & ~(unsigned long)(SLAB_SIZE - 1)))
+#define SLAB_PAGE(p)  ((unsigned long)(p) / SLAB_SIZE - (unsigned long)arena->heap_start / SLAB_SIZE)
+/* slab_map is also read without the arena lock, by the thread cache */
+#define IS_SLAB_PTR(p) (__atomic_load_n(&arena->slab_map[SLAB_PAGE(p) / 32], __ATOMIC_RELAXED) & (1u << (SLAB_PAGE(p) % 32)))
+
+/* Freed blocks waiting to be coalesced, see defer_flush */
+#define DEFER_SLOTS 32
+
+/* Per-thread caches of allocated blocks for requests up to TCACHE_MAX */
+#define TCACHE_CLASSES 32   /* one class per DSIZE step */
+#define TCACHE_MAX   (TCACHE_CLASSES * DSIZE)
+#define TCACHE_DEPTH 16     /* blocks a class holds at most */
+#define TCACHE_BATCH 8      /* blocks moved per refill or flush */
+#define TCACHE_CLASS(size) (((size) + DSIZE - 1) / DSIZE - 1)
 /* $end mallocmacros */
 
+/*
+* slab header at the start of each slab page; objects follow it
+* with no per-object header, a set bit in map means in use
+*/
+typedef struct slab {
+	struct slab *next;   /* next slab of this class with free objects */
+	struct slab *prev;
+	unsigned int osize;  /* object size of the class */
+	unsigned int nobjs;  /* objects in this slab */
+	unsigned int nfree;  /* objects not handed out */
+	unsigned int map[SLAB_MAPWORDS];
+} slab_t;
+
+/*
+* An arena is a self-contained heap in its own slice of the memlib region,
+* with its own free index and slabs. Each thread allocates from the arena
+* it is bound to, a free goes back to the arena that holds the address.
+* A single arena, the default, behaves exactly like the plain allocator.
+*/
+typedef struct arena {
+	int lock;            /* held while a thread works in the arena */
+	int id;              /* memlib slice of the arena */
+	char *heap_listp;    /* pointer to first block */
+	char *heap_start;    /* mem_arena_lo(id), base of the slab page map */
+	char *fresh;         /* memory of the last extend_heap still zero from here to the brk */
+	mm_stats_t stats;    /* counters of the arena, the sizes are filled in by mm_get_stats */
+	slab_t *slab_partial[SLAB_CLASSES]; /* slabs with free objects */
+	unsigned int *slab_map;    /* a bit per page of the slice, set for slab pages */
+	unsigned long slab_mapsize; /* words allocated for slab_map */
+	unsigned long slab_words;  /* words of slab_map that may have a bit set */
+#if MM_ARENAS > 1
+	void *remote_frees;  /* blocks freed by other threads, linked through the payload */
+#endif
+#if DEFER_COALESCE
+	void *defer_buf[DEFER_SLOTS]; /* freed blocks, still marked allocated */
+	int defer_count;
+#endif
+#if FREE_INDEX == FREE_INDEX_TLSF
+	unsigned int tlsf_fl_map;                /* first levels with a free block */
+	unsigned int tlsf_sl_map[TLSF_FL_COUNT]; /* non-empty lists per first level */
+	block_t *tlsf_heads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+#elif TREE_FOREST
+	/* left link of each pair stays null, so a pair works as a false root */
+	link_t forest_roots[FOREST_CLASSES][2];
+	unsigned int forest_map; /* classes with a non-empty tree */
+	char *tree_rootp;        /* root link of the tree being worked on */
+#endif
+} arena_t;
+
+/*
+* A thread cache keeps allocated blocks ready for the next malloc of
+* their class, a class takes any block with room for its largest request.
+*/
+typedef struct tcache {
+	int gen;             /* heap_gen the blocks belong to */
+	int count[TCACHE_CLASSES];
+	void *blocks[TCACHE_CLASSES][TCACHE_DEPTH];
+	unsigned long lookups, hits;
+} tcache_t;
+
+/* thread local once there is more than one thread to tell apart */
+#if MM_ARENAS > 1
+#define MM_TLS __thread
+#else
+#define MM_TLS
+#endif
+
 /* Global variables */
-static char *heap_listp;  /* pointer to first block */
-static int free_call_count = 0;
-static int malloc_call_count = 0;
 static char *heap_end;
+static size_t heap_max;            /* mem_heap_max(), bytes of an arena's slice */
+static size_t heap_page;           /* mem_heap_pagesize(), page the heaps sit on */
+static arena_t arenas[MM_ARENAS];
+/*
+* A heap is a set of arenas. The default heap of mm_malloc and mm_free
+* has all MM_ARENAS; a heap from mm_heap_create has one arena of its own,
+* in a memlib slice of its own, so its blocks never mix with any other.
+*/
+struct mm_heap {
+	arena_t *arenas;
+	int narenas;
+	arena_t own;         /* the arena of a created heap */
+};
+static mm_heap_t default_heap = { arenas, MM_ARENAS };
+#if MM_HEAPS > 0
+static mm_heap_t *heaps[MM_HEAPS]; /* created heaps by slice, for mm_free */
+#endif
+static struct mm_pool *pools;      /* all pools, for mm_get_stats */
+#if MM_ARENAS > 1
+static int pools_lock;
+static MM_TLS arena_t *arena;      /* arena whose lock this thread holds */
+static MM_TLS arena_t *home_arena; /* arena this thread allocates from */
+static int next_arena;             /* round-robin binding of new threads */
+static pthread_key_t exit_key;     /* its destructor cleans up after an exiting thread */
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+#else
+static arena_t *arena = &arenas[0];
+#endif
+#if THREAD_CACHE
+static MM_TLS tcache_t tcache;
+static int heap_gen;               /* bumped by mm_init, stale caches are dropped */
+#endif
+
+/*
+* Profiling probes. PROF_TIME runs stmt and adds the cycles it took to a
+* histogram, PROF_INC counts an event of the operation under way and
+* PROF_HIST moves that count into a histogram. Without MM_PROFILE they
+* leave nothing behind.
+*/
+#if MM_PROFILE
+static MM_TLS mm_profile_t prof;
+static MM_TLS unsigned long prof_nodes, prof_rotations;
+
+static inline unsigned long long prof_tsc(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline void prof_add(mm_hist_t *h, unsigned long long v)
+{
+	int b = v ? 64 - __builtin_clzll(v) : 0;
+
+	h->n++;
+	h->sum += v;
+	h->bucket[MIN(b, MM_HIST_BUCKETS - 1)]++;
+}
+
+#define PROF_TIME(h, stmt) do { \
+	unsigned long long t0_ = prof_tsc(); \
+	stmt; \
+	prof_add(&prof.h, prof_tsc() - t0_); \
+} while (0)
+#define PROF_INC(ctr) (prof_##ctr++)
+#define PROF_HIST(h, ctr) (prof_add(&prof.h, prof_##ctr), prof_##ctr = 0)
+#else
+#define PROF_TIME(h, stmt) stmt
+#define PROF_INC(ctr) ((void)0)
+#define PROF_HIST(h, ctr) ((void)0)
+#endif
+
+#if COMPACT_LINKS
+/* a function rather than a macro so val is evaluated only once */
+static inline void put_link(void *p, void *val)
+{
+	*(link_t *)p = val ? (link_t)(((char *)val - arena->heap_start) >> 3) : 0;
+}
+#endif
 /* function prototypes for internal helper routines */
 void mm_checkheap(int verbose);
 static void *extend_heap(size_t words);
+static void trim_heap(void *bp);
+static size_t adjust_size(size_t size);
+static void realloc_split(void *bp, size_t asize);
+static void carve(void *fb, void *bp, size_t asize);
+static char *align_in(void *fb, size_t asize, size_t align);
+static char *alloc_aligned(size_t asize, size_t align);
+static char *fit_aligned(size_t asize, size_t align, char **bpp);
+static void *slab_alloc(size_t size);
+static void slab_free(void *bp);
+static slab_t *slab_new(int cls);
 static void place(void *bp, size_t asize);
+#if DEFER_COALESCE
+static void *defer_take(size_t asize);
+static void defer_flush(void);
+#endif
 static void place_out_tree(void *bp, size_t asize);
-static void *find_fit_in_tree(size_t asize);
 static void *find_fit_out_tree(size_t asize);
-/* do tree insert and delete in coalesce and find_fit_in_tree */
 
+/*
+* The free block index, picked by FREE_INDEX. index_insert and
+* index_delete add and remove a free block, index_fit takes a free
+* block of at least asize bytes out of the index or returns NULL.
+* All three keep the free byte and block counts of the arena.
+*/
+#define index_insert(bp) (INDEX_INSERT((block_t *)(bp)), stat_free((bp), 1))
+#define index_delete(bp) (INDEX_DELETE((block_t *)(bp)), stat_free((bp), -1))
+#define index_fit(asize) stat_fit(INDEX_FIT(asize))
+#if FREE_INDEX == FREE_INDEX_TLSF
+#define INDEX_INSERT tlsf_insert
+#define INDEX_DELETE tlsf_delete
+#define INDEX_FIT    tlsf_find_fit
+static void tlsf_mapping(size_t size, int *fl, int *sl);
+static void tlsf_insert(block_t *bp);
+static void tlsf_delete(block_t *bp);
+static void *tlsf_find_fit(size_t asize);
+#else
+#if TREE_FOREST
+#define INDEX_INSERT forest_insert
+#define INDEX_DELETE forest_delete
+#define INDEX_FIT    forest_find_fit
+static void forest_insert(block_t *bp);
+static void forest_delete(block_t *bp);
+static void *forest_find_fit(size_t asize);
+#else
+#define INDEX_INSERT tree_insert
+#define INDEX_DELETE tree_delete
+#define INDEX_FIT    find_fit_in_tree
+#endif
+static void *find_fit_in_tree(size_t asize);
 static void tree_insert(block_t *bp);
 static void tree_delete(block_t *bp);
+static void dup_insert(block_t *x, block_t *bp);
+static void dup_promote(block_t *z);
+#if TOPDOWN_TREE
+static block_t *single_rotate(block_t *bp, int dir);
+static block_t *double_rotate(block_t *bp, int dir);
+#else
 static void right_rotate(block_t *bp);
 static void transplant(block_t* u, block_t* v);
 static void left_rotate(block_t *bp);
 static void delete_fixup(block_t *bp, block_t *par);
 static void insert_fixup(block_t *bp);
 static block_t* minimum(block_t* bp);
+#endif
+#endif /* FREE_INDEX */
+static int index_height(void);
+
+/* count a block that entered (dir 1) or left (dir -1) the free index */
+static inline void stat_free(void *bp, int dir)
+{
+	arena->stats.free_bytes += dir * (long)GET_SIZE(HDRP(bp));
+	arena->stats.free_blocks += dir;
+	if (dir > 0)
+		PROF_HIST(insert_rotations, rotations);
+	else
+		PROF_HIST(delete_rotations, rotations);
+}
+
+static inline void *stat_fit(void *bp)
+{
+	PROF_HIST(search_nodes, nodes);
+	if (bp != NULL)
+		stat_free(bp, -1);
+	return bp;
+}
 
 static void *coalesce(void *bp);  /* called in free, find_fit_in_tree and extend_heap */
 static void printblock(void *bp);
 static void checkblock(void *bp);
+static int arena_init(void);
+static arena_t *arena_home(void);
+static arena_t *heap_of(void *bp);
+static void *do_malloc(size_t size);
+static void do_free(void *bp);
+static void *do_realloc(void *ptr, size_t size);
+static void *arena_malloc(size_t size);
+static void arena_free(void *bp);
+static void *arena_realloc(void *ptr, size_t size);
+static void zero_block(char *bp, size_t size, char *fresh);
+static int arena_malloc_batch(size_t size, int n, void **out);
+static void arena_free_batch(void **ptrs, int n);
+static void pool_stats(mm_stats_t *st);
+#if THREAD_CACHE
+static void *tcache_get(int cls);
+static int tcache_put(void *bp);
+static void tcache_flush(void **blocks, int n);
+static tcache_t *tcache_self(void);
+#endif
+#if MM_ARENAS > 1
+static void remote_push(arena_t *a, void *first, void *last);
+static void remote_drain(arena_t *a);
+#endif
+
+#if MMAP_THRESHOLD > 0
+static void *huge_alloc(size_t size, size_t align);
+static void huge_free(void *bp);
+static void *huge_realloc(void *bp, size_t size);
+#endif
+
+/*
+* A huge block lives in a mapping of its own outside the arenas, which
+* starts with the size of the mapping; it is told apart by address
+*/
+#define IS_HUGE_PTR(bp) ((size_t)((char *)(bp) - (char *)mem_heap_lo()) >= heap_max * MM_ARENAS)
+
+/* arena holding block pointer bp */
+#if MM_ARENAS > 1
+#define ARENA_OF(bp) (&arenas[((char *)(bp) - (char *)mem_heap_lo()) / heap_max])
+#else
+#define ARENA_OF(bp) (&arenas[0])
+#endif
+
+/*
+* arena_lock - Take the lock of arena a and make it the one all helper
+*              routines work on. A spin lock, the critical sections are
+*              short and never block.
+*/
+static inline void arena_lock(arena_t *a)
+{
+#if MM_ARENAS > 1
+	while (__sync_lock_test_and_set(&a->lock, 1))
+		while (__atomic_load_n(&a->lock, __ATOMIC_RELAXED))
+			;
+#endif
+	arena = a;
+}
+
+static inline void arena_unlock(arena_t *a)
+{
+#if MM_ARENAS > 1
+	__sync_lock_release(&a->lock);
+#endif
+}
+
+/*
+* mm_init - Forget all arenas and set up the one of the calling thread,
+*           the others are set up by their first malloc
+*/
 int mm_init(void)
+{
+	int i;
+
+	heap_max = mem_heap_max();
+	heap_page = mem_heap_pagesize();
+	for (i = 0; i < MM_ARENAS; i++) {
+		arenas[i].id = i;
+		arenas[i].heap_listp = NULL;
+		memset(&arenas[i].stats, 0, sizeof(mm_stats_t));
+#if MM_ARENAS > 1
+		arenas[i].remote_frees = NULL;
+#endif
+	}
+#if THREAD_CACHE
+	heap_gen++;
+#endif
+	pools = NULL;                  /* their chunks are gone with the heap */
+	arena = arena_home();
+	return arena_init();
+}
+
+/*
+* mm_malloc, mm_free, mm_realloc - The public calls, timed for the profile
+*/
+void *mm_malloc(size_t size)
+{
+	void *bp;
+
+	PROF_TIME(malloc_cycles, bp = do_malloc(size));
+	return bp;
+}
+
+void mm_free(void *bp)
+{
+	PROF_TIME(free_cycles, do_free(bp));
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+	void *newp;
+
+	PROF_TIME(realloc_cycles, newp = do_realloc(ptr, size));
+	return newp;
+}
+
+/*
+* do_malloc - Allocate from the arena of the calling thread
+*/
+static void *do_malloc(size_t size)
+{
+	arena_t *a = arena_home();
+	void *bp = NULL;
+
+#if THREAD_CACHE
+	if (size > 0 && size <= TCACHE_MAX)
+		return tcache_get(TCACHE_CLASS(size));
+#endif
+#if MMAP_THRESHOLD > 0
+	if (size > MMAP_THRESHOLD)
+		return huge_alloc(size, ALIGNMENT);
+#endif
+	arena_lock(a);
+#if MM_ARENAS > 1
+	remote_drain(a);
+#endif
+	if (a->heap_listp != NULL || arena_init() == 0)
+		bp = arena_malloc(size);
+	arena_unlock(a);
+	return bp;
+}
+
+/*
+* do_free - Free a block into the arena it came from, a block of another
+*           thread's arena is queued for that arena without its lock
+*/
+static void do_free(void *bp)
+{
+	arena_t *a;
+
+	if (bp == NULL)
+		return;
+	/* outside the default heap: a huge block or a created heap's */
+	if (IS_HUGE_PTR(bp)) {
+		a = heap_of(bp);
+#if MMAP_THRESHOLD > 0
+		if (a == NULL) {
+			huge_free(bp);
+			return;
+		}
+#endif
+		arena_lock(a);
+		arena_free(bp);
+		arena_unlock(a);
+		return;
+	}
+	a = ARENA_OF(bp); /* a huge block may lie below the arenas */
+#if THREAD_CACHE
+	if (tcache_put(bp))
+		return;
+#endif
+#if MM_ARENAS > 1
+	if (a != arena_home()) {
+		remote_push(a, bp, bp);
+		return;
+	}
+#endif
+	arena_lock(a);
+	arena_free(bp);
+	arena_unlock(a);
+}
+
+/*
+* do_realloc - Resize a block inside the arena it came from
+*/
+static void *do_realloc(void *ptr, size_t size)
+{
+	arena_t *a;
+	void *newp;
+
+	if (ptr == NULL)
+		return do_malloc(size);
+	if (size == 0) {
+		do_free(ptr);
+		return NULL;
+	}
+	if (!IS_HUGE_PTR(ptr))
+		a = ARENA_OF(ptr);
+#if MMAP_THRESHOLD > 0
+	else if ((a = heap_of(ptr)) == NULL)
+		return huge_realloc(ptr, size);
+#else
+	else
+		a = heap_of(ptr);
+#endif
+	arena_lock(a);
+	newp = arena_realloc(ptr, size);
+	if (newp == ptr)
+		a->stats.realloc_inplace++;
+	else if (newp != NULL)
+		a->stats.realloc_moved++;
+	arena_unlock(a);
+	return newp;
+}
+
+#if MM_ARENAS > 1
+/*
+* thread_exit - Destructor of exit_key: hand the blocks an exiting thread
+*               still caches back to the arenas, and free the blocks other
+*               threads queued on its arena, which may have no thread left
+*               to drain them
+*/
+static void thread_exit(void *arg)
+{
+	arena_t *a = arg;
+#if THREAD_CACHE
+	tcache_t *tc = &tcache;
+	int cls;
+
+	if (tc->gen == heap_gen)
+		for (cls = 0; cls < TCACHE_CLASSES; cls++) {
+			tcache_flush(tc->blocks[cls], tc->count[cls]);
+			tc->count[cls] = 0;
+		}
+#endif
+	arena_lock(a);
+	remote_drain(a);
+	arena_unlock(a);
+}
+
+static void exit_key_init(void)
+{
+	pthread_key_create(&exit_key, thread_exit);
+}
+#endif
+
+/*
+* mm_calloc - Allocate nmemb * size zeroed bytes. A huge block is a fresh
+*             mapping and a block placed in a fresh heap extension is
+*             zero already, neither is cleared again.
+*/
+void *mm_calloc(size_t nmemb, size_t size)
+{
+	arena_t *a = arena_home();
+	size_t bytes = nmemb * size;
+	char *bp = NULL, *fresh = NULL;
+
+	if (size != 0 && bytes / size != nmemb)
+		return NULL;
+#if MMAP_THRESHOLD > 0
+	if (bytes > MMAP_THRESHOLD)
+		return huge_alloc(bytes, ALIGNMENT);
+#endif
+	/* slab objects are always reused memory */
+	if (bytes <= SLAB_MAX) {
+		if ((bp = do_malloc(bytes)) != NULL)
+			memset(bp, 0, bytes);
+		return bp;
+	}
+	arena_lock(a);
+#if MM_ARENAS > 1
+	remote_drain(a);
+#endif
+	if (a->heap_listp != NULL || arena_init() == 0) {
+		a->fresh = NULL;
+		bp = arena_malloc(bytes);
+		fresh = a->fresh;
+	}
+	arena_unlock(a);
+	if (bp != NULL)
+		zero_block(bp, bytes, fresh);
+	return bp;
+}
+
+/*
+* mm_malloc_batch - Allocate n blocks of size bytes into out, carved from
+*                   one fit under a single lock. Returns how many blocks
+*                   were allocated, n unless the heap ran out.
+*/
+int mm_malloc_batch(size_t size, int n, void **out)
+{
+	arena_t *a = arena_home();
+	int got = 0;
+
+	if (size == 0 || n <= 0)
+		return 0;
+#if MMAP_THRESHOLD > 0
+	if (size > MMAP_THRESHOLD) {
+		while (got < n && (out[got] = huge_alloc(size, ALIGNMENT)) != NULL)
+			got++;
+		return got;
+	}
+#endif
+	arena_lock(a);
+#if MM_ARENAS > 1
+	remote_drain(a);
+#endif
+	if (a->heap_listp != NULL || arena_init() == 0)
+		got = arena_malloc_batch(size, n, out);
+	arena_unlock(a);
+	return got;
+}
+
+/*
+* mm_memalign - Allocate size bytes at a multiple of align, a power of
+*               two. Returns NULL for any other align.
+*/
+void *mm_memalign(size_t align, size_t size)
+{
+	arena_t *a;
+	void *bp = NULL;
+
+	if (align == 0 || (align & (align - 1)) != 0)
+		return NULL;
+	/* every block is ALIGNMENT aligned already */
+	if (align <= ALIGNMENT)
+		return do_malloc(size);
+	if (size == 0)
+		return NULL;
+#if MMAP_THRESHOLD > 0
+	if (size > MMAP_THRESHOLD && align <= mem_pagesize())
+		return huge_alloc(size, align);
+#endif
+	a = arena_home();
+	arena_lock(a);
+#if MM_ARENAS > 1
+	remote_drain(a);
+#endif
+	if (a->heap_listp != NULL || arena_init() == 0)
+		bp = alloc_aligned(adjust_size(size), align);
+	arena_unlock(a);
+	return bp;
+}
+
+/*
+* mm_aligned_alloc - C11 aligned_alloc, the same as mm_memalign
+*/
+void *mm_aligned_alloc(size_t align, size_t size)
+{
+	return mm_memalign(align, size);
+}
+
+/* qsort order of block pointers */
+static int ptr_cmp(const void *x, const void *y)
+{
+	char *p = *(char **)x, *q = *(char **)y;
+
+	return (p > q) - (p < q);
+}
+
+/*
+* mm_free_batch - Free n blocks. ptrs is sorted in place by address, which
+*                 groups the blocks by arena and puts neighbors next to
+*                 each other; each arena is locked once for its blocks.
+*/
+void mm_free_batch(void **ptrs, int n)
+{
+	arena_t *a;
+	int i, j;
+
+	qsort(ptrs, n, sizeof(void *), ptr_cmp);
+	/* NULL entries sort first, skip them */
+	for (i = 0; i < n && ptrs[i] == NULL; i++)
+		;
+	for (; i < n; i = j) {
+		/* a huge block or a created heap's, one at a time */
+		if (IS_HUGE_PTR(ptrs[i])) {
+			do_free(ptrs[i]);
+			j = i + 1;
+			continue;
+		}
+		a = ARENA_OF(ptrs[i]);
+		for (j = i + 1; j < n && !IS_HUGE_PTR(ptrs[j]) && ARENA_OF(ptrs[j]) == a; j++)
+			;
+		arena_lock(a);
+		arena_free_batch(ptrs + i, j - i);
+		arena_unlock(a);
+	}
+}
+
+/*
+* mm_get_stats - Sum the counters of the arenas of the default heap into st
+*/
+void mm_get_stats(mm_stats_t *st)
+{
+	mm_heap_stats(NULL, st);
+}
+
+/*
+* mm_heap_stats - Sum the counters of all arenas of heap into st. Each
+*                 arena is locked to drain its remote frees and copy its
+*                 counters, no block is visited but the leftmost path of
+*                 the free tree.
+*/
+void mm_heap_stats(mm_heap_t *heap, mm_stats_t *st)
+{
+	arena_t *a;
+	int i, j, height;
+
+	if (heap == NULL)
+		heap = &default_heap;
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < heap->narenas; i++) {
+		a = &heap->arenas[i];
+		arena_lock(a);
+		if (a->heap_listp != NULL) {
+#if MM_ARENAS > 1
+			remote_drain(a); /* queued blocks are free already for their owners */
+#endif
+			st->heap_bytes += (char *)mem_arena_hi(a->id) + 1 - (char *)mem_arena_lo(a->id);
+			st->free_bytes += a->stats.free_bytes;
+			st->free_blocks += a->stats.free_blocks;
+			st->extends += a->stats.extends;
+			st->splits += a->stats.splits;
+			for (j = 0; j < 4; j++)
+				st->coalesce[j] += a->stats.coalesce[j];
+			st->realloc_inplace += a->stats.realloc_inplace;
+			st->realloc_moved += a->stats.realloc_moved;
+			height = index_height();
+			st->tree_height = MAX(st->tree_height, height);
+		}
+		arena_unlock(a);
+	}
+#if MMAP_THRESHOLD > 0
+	if (heap == &default_heap)
+		st->heap_bytes += mem_mapsize();
+#endif
+	st->live_bytes = st->heap_bytes - st->free_bytes;
+	if (heap == &default_heap)
+		pool_stats(st);
+}
+
+/*
+* mm_heap_create - Make a heap that can grow to size bytes. Everything
+*                  it hands out comes from its own slice, huge requests
+*                  included, so size caps the memory it can take.
+*/
+mm_heap_t *mm_heap_create(size_t size)
+{
+	mm_heap_t *heap;
+	int id;
+
+	if (size == 0 || (id = mem_arena_create(size)) < 0)
+		return NULL;
+	if ((heap = calloc(1, sizeof(mm_heap_t))) == NULL) {
+		mem_arena_destroy(id);
+		return NULL;
+	}
+	heap->arenas = &heap->own;
+	heap->narenas = 1;
+	heap->own.id = id;
+#if MM_HEAPS > 0
+	__atomic_store_n(&heaps[id - MM_ARENAS], heap, __ATOMIC_RELEASE);
+#endif
+	return heap;
+}
+
+/*
+* mm_heap_malloc - Allocate from heap, NULL is the default heap
+*/
+void *mm_heap_malloc(mm_heap_t *heap, size_t size)
+{
+	arena_t *a;
+	void *bp = NULL;
+
+	if (heap == NULL)
+		return mm_malloc(size);
+	a = &heap->own;
+	arena_lock(a);
+	if (a->heap_listp != NULL || arena_init() == 0)
+		bp = arena_malloc(size);
+	arena_unlock(a);
+	return bp;
+}
+
+/*
+* mm_heap_free - Free a block back into the heap it came from
+*/
+void mm_heap_free(mm_heap_t *heap, void *bp)
+{
+	arena_t *a;
+
+	if (heap == NULL) {
+		mm_free(bp);
+		return;
+	}
+	if (bp == NULL)
+		return;
+	a = &heap->own;
+	arena_lock(a);
+	arena_free(bp);
+	arena_unlock(a);
+}
+
+/*
+* heap_of - The arena of the created heap whose slice holds bp, a block
+*           outside the default heap; NULL for a huge block
+*/
+static arena_t *heap_of(void *bp)
+{
+#if MM_HEAPS > 0
+	mm_heap_t *heap;
+	char *lo;
+	int i;
+
+	for (i = 0; i < MM_HEAPS; i++) {
+		if ((heap = __atomic_load_n(&heaps[i], __ATOMIC_ACQUIRE)) == NULL)
+			continue;
+		lo = mem_arena_lo(heap->own.id);
+		if ((char *)bp >= lo && (char *)bp < lo + mem_arena_max(heap->own.id))
+			return &heap->own;
+	}
+#endif
+	return NULL;
+}
+
+/*
+* mm_heap_destroy - Give a heap and all blocks still in it back at once
+*/
+void mm_heap_destroy(mm_heap_t *heap)
+{
+	if (heap == NULL)
+		return;
+#if MM_HEAPS > 0
+	__atomic_store_n(&heaps[heap->own.id - MM_ARENAS], NULL, __ATOMIC_RELAXED);
+#endif
+	mem_arena_destroy(heap->own.id);
+	free(heap->own.slab_map);
+	free(heap);
+}
+
+/*
+* A region hands out memory by bumping a pointer through chunks taken with
+* mm_malloc and gives it all back by freeing the chunks. Each chunk starts
+* with the link to the chunk before it; the first one also holds the
+* region itself and is the one reset keeps.
+*/
+#define REGION_CHUNK  (64*1024) /* default chunk, below MMAP_THRESHOLD */
+#define REGION_LINK   ALIGNMENT /* chunk link, padded to keep objects aligned */
+#define REGION_HDR    (ALIGNMENT * ((sizeof(mm_region_t) + ALIGNMENT - 1) / ALIGNMENT))
+
+struct mm_region {
+	char *next;          /* bump pointer in the newest chunk */
+	char *end;           /* end of the newest chunk */
+	char *chunks;        /* newest chunk first, the first one is last */
+	size_t chunk_size;
+};
+
+/*
+* mm_region_create - Make a region that grows by chunks of chunk bytes,
+*                    0 for the default
+*/
+mm_region_t *mm_region_create(size_t chunk)
+{
+	mm_region_t *r;
+	char *c;
+
+	if (chunk == 0)
+		chunk = REGION_CHUNK;
+	chunk = MAX(chunk, REGION_LINK + REGION_HDR + ALIGNMENT);
+	if ((c = do_malloc(chunk)) == NULL)
+		return NULL;
+	*(char **)c = NULL;
+	r = (mm_region_t *)(c + REGION_LINK);
+	r->chunks = c;
+	r->next = c + REGION_LINK + REGION_HDR;
+	r->end = c + chunk;
+	r->chunk_size = chunk;
+	return r;
+}
+
+/*
+* mm_region_alloc - Bump size bytes off the newest chunk, starting a new
+*                   one when it is full. A request larger than a chunk
+*                   gets a chunk of its own.
+*/
+void *mm_region_alloc(mm_region_t *r, size_t size)
+{
+	size_t asize = ALIGNMENT * ((size + ALIGNMENT - 1) / ALIGNMENT);
+	size_t csize;
+	char *bp, *c;
+
+	if (size == 0 || asize < size)
+		return NULL;
+	if (asize <= (size_t)(r->end - r->next)) {
+		bp = r->next;
+		r->next += asize;
+		return bp;
+	}
+	csize = MAX(r->chunk_size, REGION_LINK + asize);
+	if (csize < asize || (c = do_malloc(csize)) == NULL)
+		return NULL;
+	*(char **)c = r->chunks;
+	r->chunks = c;
+	/* an oversized chunk is full at once, keep bumping in the current one */
+	if (csize == r->chunk_size) {
+		r->next = c + REGION_LINK + asize;
+		r->end = c + csize;
+	}
+	return c + REGION_LINK;
+}
+
+/*
+* mm_region_reset - Free every chunk but the first, all at once
+*/
+void mm_region_reset(mm_region_t *r)
+{
+	char *first = (char *)r - REGION_LINK;
+	char *c, *prev;
+
+	for (c = r->chunks; c != first; c = prev) {
+		prev = *(char **)c;
+		do_free(c);
+	}
+	r->chunks = first;
+	r->next = first + REGION_LINK + REGION_HDR;
+	r->end = first + r->chunk_size;
+}
+
+/*
+* mm_region_free - Blocks of a region are only freed with the region
+*/
+void mm_region_free(mm_region_t *r, void *bp)
+{
+}
+
+/*
+* mm_region_destroy - Free every chunk, the region goes with the first
+*/
+void mm_region_destroy(mm_region_t *r)
+{
+	mm_region_reset(r);
+	do_free((char *)r - REGION_LINK);
+}
+
+/*
+* A pool hands out objects of one size from chunks taken with mm_malloc.
+* A put object goes on the free list, linked through its first word, and
+* the next get pops it; only when the list is empty is the untouched end
+* of the newest chunk bumped. Chunks start with the link to the chunk
+* before them and go back to the heap when the pool is destroyed.
+*/
+#define POOL_CHUNK   (16*1024) /* default chunk */
+#define POOL_OBJS    16        /* objects a chunk holds at least */
+
+struct mm_pool {
+	void *free;          /* put objects */
+	char *next;          /* untouched part of the newest chunk */
+	char *end;
+	char *chunks;        /* newest chunk first */
+	size_t obj_size;     /* multiple of align */
+	size_t align;
+	unsigned long in_use;
+	unsigned long objects; /* carved from the chunks so far */
+	size_t bytes;        /* of the chunks */
+	struct mm_pool *link; /* next in pools */
+};
+
+static inline void pools_acquire(void)
+{
+#if MM_ARENAS > 1
+	while (__sync_lock_test_and_set(&pools_lock, 1))
+		while (__atomic_load_n(&pools_lock, __ATOMIC_RELAXED))
+			;
+#endif
+}
+
+static inline void pools_release(void)
+{
+#if MM_ARENAS > 1
+	__sync_lock_release(&pools_lock);
+#endif
+}
+
+/*
+* mm_pool_create - Make a pool of obj_size byte objects aligned to align,
+*                  a power of two no larger than an arena's slice, or 0
+*                  for ALIGNMENT
+*/
+mm_pool_t *mm_pool_create(size_t obj_size, size_t align)
+{
+	mm_pool_t *p;
+	size_t stride;
+
+	if (align == 0)
+		align = ALIGNMENT;
+	if ((align & (align - 1)) != 0 || align > heap_max || obj_size == 0)
+		return NULL;
+	align = MAX(align, sizeof(void *));
+	/* neither the stride of the objects nor pool_grow's chunk may wrap */
+	if (obj_size > SIZE_MAX - (align - 1))
+		return NULL;
+	stride = (obj_size + align - 1) & ~(align - 1);
+	if (stride > (SIZE_MAX - align) / POOL_OBJS)
+		return NULL;
+	if ((p = do_malloc(sizeof(mm_pool_t))) == NULL)
+		return NULL;
+	memset(p, 0, sizeof(mm_pool_t));
+	p->obj_size = stride;
+	p->align = align;
+	pools_acquire();
+	p->link = pools;
+	pools = p;
+	pools_release();
+	return p;
+}
+
+/*
+* pool_grow - Take a new chunk and make it the one to bump from
+*/
+static int pool_grow(mm_pool_t *p)
+{
+	size_t csize = MAX(POOL_CHUNK, p->align + POOL_OBJS * p->obj_size);
+	char *c;
+
+	if ((c = mm_memalign(p->align, csize)) == NULL)
+		return -1;
+	*(char **)c = p->chunks;
+	p->chunks = c;
+	p->next = c + p->align; /* objects after the link keep their alignment */
+	p->end = c + csize;
+	p->bytes += csize;
+	return 0;
+}
+
+/*
+* mm_pool_get - Pop an object off the free list, or carve the next one
+*/
+void *mm_pool_get(mm_pool_t *p)
+{
+	void *obj = p->free;
+
+	if (obj != NULL) {
+		p->free = *(void **)obj;
+	} else {
+		if ((size_t)(p->end - p->next) < p->obj_size && pool_grow(p) < 0)
+			return NULL;
+		obj = p->next;
+		p->next += p->obj_size;
+		p->objects++;
+	}
+	p->in_use++;
+	return obj;
+}
+
+/*
+* mm_pool_put - Push an object back on the free list of its pool
+*/
+void mm_pool_put(mm_pool_t *p, void *obj)
+{
+	if (obj == NULL)
+		return;
+	*(void **)obj = p->free;
+	p->free = obj;
+	p->in_use--;
+}
+
+/*
+* mm_pool_destroy - Give all chunks of a pool back, with every object
+*/
+void mm_pool_destroy(mm_pool_t *p)
+{
+	mm_pool_t **pp;
+	char *c, *prev;
+
+	pools_acquire();
+	for (pp = &pools; *pp != NULL; pp = &(*pp)->link)
+		if (*pp == p) {
+			*pp = p->link;
+			break;
+		}
+	pools_release();
+	for (c = p->chunks; c != NULL; c = prev) {
+		prev = *(char **)c;
+		do_free(c);
+	}
+	do_free(p);
+}
+
+/*
+* pool_stats - Add the occupancy of all pools to st. Counters of a pool
+*              in use by another thread are read as they are.
+*/
+static void pool_stats(mm_stats_t *st)
+{
+	mm_pool_t *p;
+
+	pools_acquire();
+	for (p = pools; p != NULL; p = p->link) {
+		st->pools++;
+		st->pool_bytes += p->bytes;
+		st->pool_objects += p->objects;
+		st->pool_in_use += p->in_use;
+	}
+	pools_release();
+}
+
+#if MM_PROFILE
+/*
+* mm_get_profile - Copy the histograms of the calling thread into p and
+*                  start them over
+*/
+void mm_get_profile(mm_profile_t *p)
+{
+	*p = prof;
+	memset(&prof, 0, sizeof(prof));
+}
+#else
+/*
+* mm_get_profile - No profile in this build, all histograms empty
+*/
+void mm_get_profile(mm_profile_t *p)
+{
+	memset(p, 0, sizeof(*p));
+}
+#endif /* MM_PROFILE */
+
+/*
+* index_height - Nodes on the leftmost path of the free tree of the
+*                current arena, the largest over a forest. A red-black
+*                tree is at most twice as high.
+*/
+static int index_height(void)
+{
+	int height = 0;
+#if FREE_INDEX == FREE_INDEX_RBTREE
+	block_t *bp;
+#if TREE_FOREST
+	int c, h;
+
+	for (c = 0; c < FOREST_CLASSES; c++) {
+		for (h = 0, bp = GET_LINK(FOREST_ROOTP(c)); bp != NULL; bp = LEFT_BLK(bp))
+			h++;
+		height = MAX(height, h);
+	}
+#else
+	for (bp = GET_LINK(ROOTP); bp != NULL; bp = LEFT_BLK(bp))
+		height++;
+#endif
+#endif
+	return height;
+}
+
+/*
+* arena_home - The arena of the calling thread, threads are bound round-robin
+*              and registered for thread_exit when first bound
+*/
+static arena_t *arena_home(void)
+{
+#if MM_ARENAS > 1
+	if (home_arena == NULL) {
+		home_arena = &arenas[__sync_fetch_and_add(&next_arena, 1) % MM_ARENAS];
+		pthread_once(&exit_once, exit_key_init);
+		pthread_setspecific(exit_key, home_arena);
+	}
+	return home_arena;
+#else
+	return &arenas[0];
+#endif
+}
+
+#if THREAD_CACHE
+/*
+* tcache_self - The cache of the calling thread. Blocks from before the
+*               last mm_init are gone with their heap and are dropped; a
+*               thread that only frees is bound here, so that thread_exit
+*               still empties its cache.
+*/
+static tcache_t *tcache_self(void)
+{
+	tcache_t *tc = &tcache;
+
+	if (tc->gen != heap_gen) {
+		memset(tc->count, 0, sizeof(tc->count));
+		tc->gen = heap_gen;
+		arena_home();
+	}
+	return tc;
+}
+
+/*
+* tcache_get - Pop a block of class cls off the thread cache, refilling
+*              the class with a batch of blocks under one arena lock
+*/
+static void *tcache_get(int cls)
+{
+	tcache_t *tc = tcache_self();
+	arena_t *a;
+	void *bp;
+
+	tc->lookups++;
+	if (tc->count[cls] > 0) {
+		tc->hits++;
+		return tc->blocks[cls][--tc->count[cls]];
+	}
+
+	a = arena_home();
+	arena_lock(a);
+#if MM_ARENAS > 1
+	remote_drain(a);
+#endif
+	if (a->heap_listp != NULL || arena_init() == 0)
+		while (tc->count[cls] < TCACHE_BATCH &&
+			(bp = arena_malloc((cls + 1) * DSIZE)) != NULL)
+			tc->blocks[cls][tc->count[cls]++] = bp;
+	arena_unlock(a);
+	return tc->count[cls] > 0 ? tc->blocks[cls][--tc->count[cls]] : NULL;
+}
+
+/*
+* tcache_put - Keep a freed block in the thread cache if it is small
+*              enough, return 0 to have the caller free it for real.
+*              Only the block's own header and slab bit are read, and
+*              other threads change neither while the block is allocated.
+*/
+static int tcache_put(void *bp)
+{
+	tcache_t *tc = tcache_self();
+	size_t payload;
+	int cls;
+
+	arena = ARENA_OF(bp);
+	if (IS_SLAB_PTR(bp))
+		payload = SLAB_OF(bp)->osize;
+	else
+		payload = (__atomic_load_n((uint32_t *)HDRP(bp), __ATOMIC_RELAXED) & ~0x7) - WSIZE;
+	if (payload > TCACHE_MAX)
+		return 0;
+	cls = payload / DSIZE - 1;
+
+	/* full, hand the oldest batch back to the arenas */
+	if (tc->count[cls] == TCACHE_DEPTH) {
+		tcache_flush(tc->blocks[cls], TCACHE_BATCH);
+		memmove(tc->blocks[cls], tc->blocks[cls] + TCACHE_BATCH,
+			(TCACHE_DEPTH - TCACHE_BATCH) * sizeof(void *));
+		tc->count[cls] -= TCACHE_BATCH;
+	}
+	tc->blocks[cls][tc->count[cls]++] = bp;
+	return 1;
+}
+
+/*
+* tcache_flush - Free n cached blocks, taking the home arena lock once
+*                for a run of its blocks and queueing a run of blocks of
+*                another arena with one push
+*/
+static void tcache_flush(void **blocks, int n)
+{
+	arena_t *a;
+	int i, j, k;
+
+	for (i = 0; i < n; i = j) {
+		a = ARENA_OF(blocks[i]);
+		for (j = i + 1; j < n && ARENA_OF(blocks[j]) == a; j++)
+			;
+#if MM_ARENAS > 1
+		if (a != arena_home()) {
+			for (k = i; k < j - 1; k++)
+				*(void **)blocks[k] = blocks[k + 1];
+			remote_push(a, blocks[i], blocks[j - 1]);
+			continue;
+		}
+#endif
+		arena_lock(a);
+		for (k = i; k < j; k++)
+			arena_free(blocks[k]);
+		arena_unlock(a);
+	}
+}
+
+/*
+* mm_cache_stats - Thread cache lookups and hits of the calling thread
+*/
+void mm_cache_stats(unsigned long *lookups, unsigned long *hits)
+{
+	*lookups = tcache.lookups;
+	*hits = tcache.hits;
+}
+#else
+/*
+* mm_cache_stats - No thread cache in this build, nothing looked up
+*/
+void mm_cache_stats(unsigned long *lookups, unsigned long *hits)
+{
+	*lookups = 0;
+	*hits = 0;
+}
+#endif /* THREAD_CACHE */
+
+#if MM_ARENAS > 1
+/*
+* remote_push - Queue the chain first..last of blocks freed by another
+*               thread on arena a. Lock free: the blocks are linked
+*               through their first payload word and the chain goes on
+*               the queue with one compare-and-swap, any number of threads
+*               can push while the arena is busy.
+*/
+static void remote_push(arena_t *a, void *first, void *last)
+{
+	void *head = __atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED);
+
+	do
+		*(void **)last = head;
+	while (!__atomic_compare_exchange_n(&a->remote_frees, &head, first, 1,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+* remote_drain - Free the blocks queued by other threads on arena a,
+*                whose lock the caller holds. The whole queue is taken
+*                in one exchange, so there is a single consumer at a time
+*                and no ABA on the pop.
+*/
+static void remote_drain(arena_t *a)
+{
+	void *bp, *next;
+
+	if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) == NULL)
+		return;
+	bp = __atomic_exchange_n(&a->remote_frees, NULL, __ATOMIC_ACQUIRE);
+	for (; bp != NULL; bp = next) {
+		next = *(void **)bp;
+		arena_free(bp);
+	}
+}
+#endif
+
+#if MMAP_THRESHOLD > 0
+/* mapping size for a huge block of size payload bytes at offset off */
+#define HUGE_MAPSIZE(size, off) (((size) + (off) + mem_pagesize() - 1) & ~(mem_pagesize() - 1))
+/* start of the mapping, the header is always in its first page */
+#define HUGE_BASE(bp) ((char *)((unsigned long)HDRP(bp) & ~(unsigned long)(mem_pagesize() - 1)))
+/* the mapping size is kept in a full word at its start, it may not fit a header */
+#define HUGE_SIZE(bp) (*(size_t *)HUGE_BASE(bp))
+
+/*
+* huge_alloc - Map a block of its own for a request above MMAP_THRESHOLD.
+*              The payload starts ALIGNMENT into the mapping, or align
+*              bytes for a larger alignment up to a page. No arena lock
+*              is taken.
+*/
+static void *huge_alloc(size_t size, size_t align)
+{
+	size_t off = MAX(align, ALIGNMENT);
+	size_t msize = HUGE_MAPSIZE(size, off);
+	char *p;
+
+	if ((p = mem_map(msize)) == NULL)
+		return NULL;
+	*(size_t *)p = msize;
+	PUT(p + off - WSIZE, PACK(0, 1));
+	return p + off;
+}
+
+/*
+* huge_free - Give the mapping of a huge block back right away
+*/
+static void huge_free(void *bp)
+{
+	mem_unmap(HUGE_BASE(bp), HUGE_SIZE(bp));
+}
+
+/*
+* huge_realloc - Resize the mapping of a huge block, the pages are moved
+*                if it has to move, the payload is never copied
+*/
+static void *huge_realloc(void *bp, size_t size)
+{
+	char *base = HUGE_BASE(bp);
+	size_t off = (char *)bp - base;
+	size_t oldsize = HUGE_SIZE(bp);
+	size_t msize = HUGE_MAPSIZE(size, off);
+	char *p;
+
+	if (msize == oldsize)
+		return bp;
+	if ((p = mem_remap(base, oldsize, msize)) == NULL)
+		return NULL;
+	*(size_t *)p = msize;
+	return p + off;
+}
+#endif /* MMAP_THRESHOLD */
+
+/*
+* arena_init - Create the initial heap of the current arena
+*/
+static int arena_init(void)
 {
 	//printf("\nmm_init in\n");
 	char * bp = NULL;
+	unsigned long words = mem_arena_max(arena->id) / SLAB_SIZE / 32 + 1;
+	/* forget the slabs of the previous heap, the page map is kept unless the slice grew */
+	arena->heap_start = mem_arena_lo(arena->id);
+	memset(arena->slab_partial, 0, sizeof(arena->slab_partial));
+	if (words > arena->slab_mapsize) {
+		free(arena->slab_map);
+		arena->slab_mapsize = arena->slab_words = 0;
+		if ((arena->slab_map = calloc(words, sizeof(unsigned int))) == NULL)
+			return -1;
+		arena->slab_mapsize = words;
+	}
+	memset(arena->slab_map, 0, arena->slab_words * sizeof(unsigned int));
+	arena->slab_words = 0;
+#if DEFER_COALESCE
+	arena->defer_count = 0;
+#endif
+#if FREE_INDEX == FREE_INDEX_TLSF
+	arena->tlsf_fl_map = 0;
+	memset(arena->tlsf_sl_map, 0, sizeof(arena->tlsf_sl_map));
+	memset(arena->tlsf_heads, 0, sizeof(arena->tlsf_heads));
+#elif TREE_FOREST
+	memset(arena->forest_roots, 0, sizeof(arena->forest_roots));
+	arena->forest_map = 0;
+#endif
 	/* create the initial empty heap */
-	if ((heap_listp = mem_sbrk(4*WSIZE+3 * DSIZE)) == NULL)
+	if ((arena->heap_listp = mem_sbrk_arena(arena->id, ALIGNMENT + 4 * DSIZE)) == (void *)-1) {
+		arena->heap_listp = NULL;
 		return -1;
-	/* initialize tree root */
-	/* put tree root size */
-	PUT(heap_listp, 0);
-	//PUT(heap_listp + WSIZE, 0);
-	PUT(heap_listp + WSIZE, PACK(POINTER_OVERHEAD + OVERHEAD, 1));  /* prologue header */
-	PUT_ADDRESS(heap_listp + DSIZE, NULL);     /* put root tree address*/
-		
-	PUT_ADDRESS(heap_listp + 2 * DSIZE, NULL); /* left is null */
-	PUT_ADDRESS(heap_listp + 3 * DSIZE, NULL); /* right is null */
-	
-	PUT(heap_listp + 4 * DSIZE, PACK(POINTER_OVERHEAD + OVERHEAD, 1));  /* prologue footer */
-	PUT(heap_listp + WSIZE + 4 * DSIZE, PACK(0, 1));   /* epilogue header */
-		
-	heap_listp += DSIZE;
+	}
+	/* pad so the prologue payload, which holds the tree root, is aligned */
+	memset(arena->heap_listp, 0, ALIGNMENT - WSIZE);
+	arena->heap_listp += ALIGNMENT;
+	PUT(HDRP(arena->heap_listp), PACK(4 * DSIZE, 1 | PREV_ALLOC));  /* prologue header */
+	memset(arena->heap_listp, 0, 3 * DSIZE);  /* empty tree, root and links are null */
+	PUT(FTRP(arena->heap_listp), PACK(4 * DSIZE, 1));  /* prologue footer */
+	PUT(HDRP(NEXT_BLKP(arena->heap_listp)), PACK(0, 1 | PREV_ALLOC));   /* epilogue header */
 
 	
 
@@ -155,12 +1602,11 @@ int mm_init(void)
 
 
 /*
-* mm_malloc - Allocate a block with at least size bytes of payload
+* arena_malloc - Allocate a block with at least size bytes of payload
 */
 /* $begin mmmalloc */
-void *mm_malloc(size_t size)
+static void *arena_malloc(size_t size)
 {
-	//printf("\nmalloc in: malloc count: %d\n",malloc_call_count++);
 #ifdef checkheap
 		mm_checkheap(VERBOSE);
 #endif // checkheap
@@ -172,14 +1618,31 @@ void *mm_malloc(size_t size)
 	if (size <= 0)
 		return NULL;
 
+	/* Small requests come from the slab of their size class */
+	if (size <= SLAB_MAX)
+		return slab_alloc(size);
+
 	/* Adjust block size to include overhead and alignment reqs. */
-	if (size <= DSIZE + POINTER_OVERHEAD)
-		asize = DSIZE + OVERHEAD + POINTER_OVERHEAD;
-	else
-		asize = DSIZE * ((size +POINTER_OVERHEAD+(OVERHEAD)+(DSIZE - 1)) / DSIZE);
+	asize = adjust_size(size);
+	if (asize > MAX_BLKSIZE)
+		return NULL;
 
-	/* Search the red black tree for a fit */
-	if ((bp = find_fit_in_tree(asize)) != NULL) {
+#if DEFER_COALESCE
+	/* a recently freed block that fits without a split skips the index */
+	if ((bp = defer_take(asize)) != NULL)
+		return bp;
+#endif
+
+	/* Search the free index for a fit */
+	bp = index_fit(asize);
+#if DEFER_COALESCE
+	/* merge the buffered blocks into the index and search again */
+	if (bp == NULL && arena->defer_count > 0) {
+		defer_flush();
+		bp = index_fit(asize);
+	}
+#endif
+	if (bp != NULL) {
 		place(bp, asize);
 	//printf("\n malloc out check: return bp: %p\n",bp);
 #ifdef checkheap
@@ -197,32 +1660,109 @@ void *mm_malloc(size_t size)
 		return NULL;
 	}
 
-	if ((bp = find_fit_in_tree(asize)) != NULL) {
-		place(bp, asize);
-	//printf("\n malloc out check: return bp: %p\n",bp);
+	/* the new free block is big enough, place in it directly */
+	index_delete(bp);
+	place(bp, asize);
 #ifdef checkheap
-		mm_checkheap(VERBOSE);
+	mm_checkheap(VERBOSE);
 #endif // checkheap
-		
-		return bp;
+	return bp;
+}
+/* $end mmmalloc */
+
+/*
+* zero_block - Clear the first size bytes of block bp for calloc. When
+*              fresh lies in the block, bp was placed in the free block
+*              extend_heap just made: from fresh on only its links and
+*              footer were written, the rest is still zero. Memory that
+*              went back to memlib and was extended again is cleared.
+*/
+static void zero_block(char *bp, size_t size, char *fresh)
+{
+	char *end = bp + size;
+	char *ftr = FTRP(bp);
+
+	if (fresh < bp || fresh > end) {
+		memset(bp, 0, size);
+		return;
 	}
+	memset(bp, 0, MIN(MAX(fresh, bp + MIN_BLKSIZE), end) - bp);
+	if (ftr < end)
+		memset(ftr, 0, MIN(ftr + DSIZE, end) - ftr);
+}
 
+/*
+* arena_malloc_batch - Allocate n blocks of size bytes as one run taken
+*                      from a single fit, then cut the run into blocks by
+*                      writing their headers. Without a fit for the run,
+*                      falls back to one arena_malloc per block. Returns
+*                      the blocks allocated.
+*/
+static int arena_malloc_batch(size_t size, int n, void **out)
+{
+	size_t asize, runsize, bsize, prev;
+	char *bp;
+	int i;
+
+	/* slab objects are carved a page at a time already */
+	if (size <= SLAB_MAX) {
+		for (i = 0; i < n && (out[i] = slab_alloc(size)) != NULL; i++)
+			;
+		return i;
+	}
+
+	/* take the run from one free block, the heap only grows block by block */
+	asize = adjust_size(size);
+	if (asize > MAX_BLKSIZE)
+		return 0;
+	if (n > MIN(heap_max, MAX_BLKSIZE) / asize || (bp = index_fit(asize * n)) == NULL) {
+		for (i = 0; i < n && (out[i] = arena_malloc(size)) != NULL; i++)
+			;
+		return i;
+	}
+	place(bp, asize * n);
+
+	/* the last block keeps any tail place could not split off */
+	runsize = GET_SIZE(HDRP(bp));
+	prev = GET_PREV_ALLOC(HDRP(bp));
+	for (i = 0; i < n; i++) {
+		bsize = (i == n - 1) ? runsize - (n - 1) * asize : asize;
+		PUT(HDRP(bp), PACK(bsize, 1 | prev));
+		out[i] = bp;
+		bp += bsize;
+		prev = PREV_ALLOC;
+	}
+#ifdef checkheap
+	mm_checkheap(VERBOSE);
+#endif // checkheap
+	return n;
 }
-/* $end mmmalloc */
 
 /*
-* mm_free - Free a block
+* arena_free - Free a block
 */
 /* $begin mmfree */
-void mm_free(void *bp)
+static void arena_free(void *bp)
 {
-	//printf("\nfree in: free count: %d\n",free_call_count++);
-	size_t size = GET_SIZE(HDRP(bp));
+	size_t size;
+
+	if (IS_SLAB_PTR(bp)) {
+		slab_free(bp);
+		return;
+	}
+#if DEFER_COALESCE
+	/* park the block, it stays marked allocated so no neighbor merges with it */
+	if (arena->defer_count == DEFER_SLOTS)
+		defer_flush();
+	arena->defer_buf[arena->defer_count++] = bp;
+	return;
+#endif
+	size = GET_SIZE(HDRP(bp));
 
-	PUT(HDRP(bp), PACK(size, 0));
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
 	PUT(FTRP(bp), PACK(size, 0));
 
-	coalesce(bp);
+	trim_heap(coalesce(bp));
 #ifdef checkheap
 	mm_checkheap(VERBOSE);
 #endif // checkheap
@@ -232,24 +1772,145 @@ void mm_free(void *bp)
 /* $end mmfree */
 
 /*
-* mm_realloc - naive implementation of mm_realloc
+* arena_free_batch - Free n blocks sorted by address. A run of blocks
+*                    that follow each other in the heap becomes one free
+*                    block, so it is coalesced and indexed only once.
+*/
+static void arena_free_batch(void **ptrs, int n)
+{
+	char *bp;
+	size_t size;
+	int i, j;
+
+	for (i = 0; i < n; i = j) {
+		bp = ptrs[i];
+		j = i + 1;
+		if (IS_SLAB_PTR(bp)) {
+			slab_free(bp);
+			continue;
+		}
+		size = GET_SIZE(HDRP(bp));
+		while (j < n && (char *)ptrs[j] == bp + size && !IS_SLAB_PTR(ptrs[j]) &&
+			size + GET_SIZE(HDRP(ptrs[j])) <= MAX_BLKSIZE)
+			size += GET_SIZE(HDRP(ptrs[j++]));
+		PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+		PUT(FTRP(bp), PACK(size, 0));
+		trim_heap(coalesce(bp));
+	}
+#ifdef checkheap
+	mm_checkheap(VERBOSE);
+#endif // checkheap
+}
+
+/*
+* arena_realloc - Resize a block, in place whenever the neighbors allow it:
+*   shrink by splitting off the tail, grow into a free next block,
+*   extend the heap when the block is the last one, or slide back into
+*   a free previous block. Only fall back to malloc-copy-free otherwise.
 */
-void *mm_realloc(void *ptr, size_t size)
+static void *arena_realloc(void *ptr, size_t size)
 {
-	
 	void *newp;
-	size_t copySize;
-	copySize = GET_SIZE(HDRP(ptr));
-	
-	if ((newp = mm_malloc(size)) == NULL) {
+	void *next, *prev;
+	size_t asize, oldsize, copySize, newsize;
+	size_t next_alloc, prev_alloc;
+
+	/* slab objects stay put while the request fits their class */
+	if (IS_SLAB_PTR(ptr)) {
+		oldsize = SLAB_OF(ptr)->osize;
+		if (size <= oldsize && SLAB_CLASS(size) == SLAB_CLASS(oldsize))
+			return ptr;
+#if MMAP_THRESHOLD > 0
+		if (size > MMAP_THRESHOLD && arena->id < MM_ARENAS)
+			newp = huge_alloc(size, ALIGNMENT);
+		else
+#endif
+			newp = arena_malloc(size);
+		if (newp == NULL)
+			return NULL;
+		memcpy(newp, ptr, MIN(size, oldsize));
+		slab_free(ptr);
+		return newp;
+	}
+
+	asize = adjust_size(size);
+	oldsize = GET_SIZE(HDRP(ptr));
+
+#if MMAP_THRESHOLD > 0
+	/*
+	 * case 0: grown past the threshold, move to a mapping of its own. An
+	 * arena block already that large (from mm_memalign, say) that shrinks
+	 * stays in the arena, and so does a block of a created heap.
+	 */
+	if (size > MMAP_THRESHOLD && asize > oldsize && arena->id < MM_ARENAS) {
+		if ((newp = huge_alloc(size, ALIGNMENT)) == NULL)
+			return NULL;
+		memcpy(newp, ptr, MIN(size, oldsize - WSIZE));
+		arena_free(ptr);
+		return newp;
+	}
+#endif
+
+	if (asize > MAX_BLKSIZE)
+		return NULL;
+
+	/* case 1: shrink (or same size), give the tail back to the tree */
+	if (asize <= oldsize) {
+		realloc_split(ptr, asize);
+		return ptr;
+	}
+
+	next = NEXT_BLKP(ptr);
+	next_alloc = GET_ALLOC(HDRP(next));
+	newsize = oldsize + (next_alloc ? 0 : GET_SIZE(HDRP(next)));
+
+	/* case 2: the block is last in the heap, grow the heap under it */
+	if (newsize < asize && (GET_SIZE(HDRP(next)) == 0 ||
+		(!next_alloc && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0))) {
+		/* extend_heap coalesced the new space with a free next block */
+		if (extend_heap(MAX(asize - newsize, MIN_BLKSIZE) / WSIZE) != NULL)
+			next_alloc = 0;
+		/* at the cap of the heap the block may still move */
+	}
+
+	/* case 3: absorb the free next block */
+	if (!next_alloc && oldsize + GET_SIZE(HDRP(next)) >= asize &&
+		oldsize + GET_SIZE(HDRP(next)) <= MAX_BLKSIZE) {
+		index_delete(next);
+		newsize = oldsize + GET_SIZE(HDRP(next));
+		PUT(HDRP(ptr), PACK(newsize, 1 | GET_PREV_ALLOC(HDRP(ptr))));
+		SET_PREV_ALLOC(NEXT_BLKP(ptr));
+		realloc_split(ptr, asize);
+		return ptr;
+	}
+
+	/* case 4: slide back into a free previous block (and a free next one) */
+	prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
+	prev = prev_alloc ? NULL : PREV_BLKP(ptr);
+	newsize = oldsize + (prev_alloc ? 0 : GET_SIZE(HDRP(prev))) +
+		(next_alloc ? 0 : GET_SIZE(HDRP(next)));
+	if (!prev_alloc && newsize >= asize && newsize <= MAX_BLKSIZE) {
+		index_delete(prev);
+		if (!next_alloc)
+			index_delete(next);
+		/* move the payload before a split header can land inside it */
+		memmove(prev, ptr, oldsize - WSIZE);
+		PUT(HDRP(prev), PACK(newsize, 1 | GET_PREV_ALLOC(HDRP(prev))));
+		SET_PREV_ALLOC(NEXT_BLKP(prev));
+		realloc_split(prev, asize);
+		return prev;
+	}
+
+	/* case 5: no room around the block, move it */
+	if ((newp = arena_malloc(size)) == NULL) {
 		printf("ERROR: mm_malloc failed in mm_realloc\n");
-		exit(1);
+		return NULL;
 	}
-	
+	copySize = oldsize - WSIZE;
 	if (size < copySize)
 		copySize = size;
 	memcpy(newp, ptr, copySize);
-	mm_free(ptr);
+	arena_free(ptr);
 	return newp;
 }
 
@@ -258,17 +1919,17 @@ void *mm_realloc(void *ptr, size_t size)
 */
 void mm_checkheap(int verbose)
 {
-	char *bp = heap_listp;
+	char *bp = arena->heap_listp;
 
 	if (verbose)
-		printf("Heap (%p):\n", heap_listp);
+		printf("Heap (%p):\n", arena->heap_listp);
 
-	if ((GET_SIZE(HDRP(heap_listp)) != 4 * DSIZE) || !GET_ALLOC(HDRP(heap_listp)))
-		printf("Bad prologue header, size=%d, alloc=%d\n", GET_SIZE(HDRP(heap_listp)), GET_ALLOC(HDRP(heap_listp)));
-	checkblock(heap_listp);
-	printblock(heap_listp);
+	if ((GET_SIZE(HDRP(arena->heap_listp)) != 4 * DSIZE) || !GET_ALLOC(HDRP(arena->heap_listp)))
+		printf("Bad prologue header, size=%d, alloc=%d\n", GET_SIZE(HDRP(arena->heap_listp)), GET_ALLOC(HDRP(arena->heap_listp)));
+	checkblock(arena->heap_listp);
+	printblock(arena->heap_listp);
 	printf("\nmemory:\n");
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+	for (bp = arena->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
 #ifdef printalloc
 	if(verbose)
 		printblock(bp);
@@ -298,18 +1959,38 @@ void mm_checkheap(int verbose)
 static void *extend_heap(size_t words)
 {
 	
-	char *bp;
+	char *bp, *clean = mem_arena_clean(arena->id);
 	size_t size;
 	//heap_end = mem_heap_hi();
 	//printf("\nextend_heap in\n");
 	
-	/* Allocate an even number of words to maintain alignment */
-	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-	if ((bp = mem_sbrk(size)) == (void *)-1)
+	/* Allocate a multiple of ALIGNMENT to maintain alignment */
+	size = ALIGNMENT * ((words * WSIZE + ALIGNMENT - 1) / ALIGNMENT);
+	/* on huge pages grow up to a page boundary, the page is committed anyway */
+	if (heap_page > mem_pagesize()) {
+		char *brk = (char *)mem_arena_hi(arena->id) + 1;
+		size = (((size_t)brk + size + heap_page - 1) & ~(heap_page - 1)) - (size_t)brk;
+	}
+	/* the new block must fit a header, coalesce keeps merged ones within it */
+	if (size > MAX_BLKSIZE)
+		return NULL;
+#if COMPACT_LINKS
+	if ((char *)mem_arena_hi(arena->id) + 1 - arena->heap_start + size > COMPACT_HEAP_MAX)
+		return NULL;
+#endif
+	/* a heap at the end of its slice, a created one at its cap, fails quietly */
+	if (size > mem_arena_max(arena->id) -
+		(size_t)((char *)mem_arena_hi(arena->id) + 1 - arena->heap_start))
+		return NULL;
+	if ((bp = mem_sbrk_arena(arena->id, size)) == (void *)-1)
 		return NULL;
 
+	/* memory memlib never handed out is zero, calloc can skip it while it is untouched */
+	arena->fresh = MAX(bp, clean);
+	arena->stats.extends++;
+
 	/* Initialize free block header/footer and the epilogue header */
-	PUT(HDRP(bp), PACK(size, 0));         /* free block header */
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)))); /* free block header */
 	PUT(FTRP(bp), PACK(size, 0));         /* free block footer */
 	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
 
@@ -320,6 +2001,166 @@ static void *extend_heap(size_t words)
 }
 /* $end mmextendheap */
 
+/*
+* trim_heap - Give the free block bp back to memlib when it is the last
+*             block of the heap and larger than TRIM_THRESHOLD
+*/
+static void trim_heap(void *bp)
+{
+#if TRIM_THRESHOLD > 0
+	size_t size = GET_SIZE(HDRP(bp));
+
+	if (size <= TRIM_THRESHOLD || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+		return;
+	index_delete(bp);
+	/* the header of bp becomes the epilogue, after whatever preceded bp */
+	PUT(HDRP(bp), PACK(0, 1 | GET_PREV_ALLOC(HDRP(bp))));
+	mem_sbrk_arena(arena->id, -(intptr_t)size);
+#endif
+}
+
+/*
+* carve - Allocate asize bytes at bp inside free block fb, which is no
+*         longer in the tree. The slack in front of bp must be empty or
+*         big enough to be a free block; both slacks go to the tree.
+*/
+static void carve(void *fb, void *bp, size_t asize)
+{
+	size_t fsize = GET_SIZE(HDRP(fb));
+	size_t lead = (char *)bp - (char *)fb;
+	size_t prev_alloc = GET_PREV_ALLOC(HDRP(fb));
+
+	if (lead > 0) {
+		PUT(HDRP(fb), PACK(lead, prev_alloc));
+		PUT(FTRP(fb), PACK(lead, 0));
+		index_insert(fb);
+		arena->stats.splits++;
+		prev_alloc = 0;
+	}
+	if (fsize - lead - asize < MIN_BLKSIZE)
+		asize = fsize - lead;
+	PUT(HDRP(bp), PACK(asize, 1 | prev_alloc));
+	if (fsize - lead > asize) {
+		fb = NEXT_BLKP(bp);
+		PUT(HDRP(fb), PACK(fsize - lead - asize, PREV_ALLOC));
+		PUT(FTRP(fb), PACK(fsize - lead - asize, 0));
+		index_insert(fb);
+		arena->stats.splits++;
+	}
+	else
+		SET_PREV_ALLOC(NEXT_BLKP(bp));
+}
+
+/*
+* alloc_aligned - Allocate a block of asize bytes whose block pointer is a
+*                 multiple of align. The slack in front of it goes back to
+*                 the index as a free block, carve splits off the tail.
+*/
+static char *alloc_aligned(size_t asize, size_t align)
+{
+	char *brk;
+	char *fb;
+	char *bp = NULL;
+
+	/* the block and the room to align it must fit a header */
+	if (asize > MAX_BLKSIZE || align + MIN_BLKSIZE > MAX_BLKSIZE - asize)
+		return NULL;
+
+	fb = fit_aligned(asize, align, &bp);
+#if DEFER_COALESCE
+	/* merge the buffered blocks into the index and search again */
+	if (fb == NULL && arena->defer_count > 0) {
+		defer_flush();
+		fb = fit_aligned(asize, align, &bp);
+	}
+#endif
+
+	/* nothing in the index, grow the heap, merging with a free last block */
+	if (fb == NULL) {
+		brk = (char *)mem_arena_hi(arena->id) + 1;
+		fb = brk;
+		if (!GET_PREV_ALLOC(brk - WSIZE))
+			fb = brk - GET_SIZE(brk - DSIZE);
+		bp = align_in(fb, 0, align);
+		if (bp + asize > brk &&
+			(fb = extend_heap((bp + asize - brk) / WSIZE)) == NULL)
+			return NULL;
+		/* extend_heap left the last block apart, the merge would outgrow a header */
+		if ((char *)fb > bp && (bp = align_in(fb, asize, align)) == NULL)
+			return NULL;
+		index_delete(fb);
+	}
+	carve(fb, bp, asize);
+	return bp;
+}
+
+/*
+* fit_aligned - Take a free block out of the index with room for an
+*               align-aligned block of asize bytes, set *bpp to that
+*               block pointer. Returns NULL when the index has none.
+*/
+static char *fit_aligned(size_t asize, size_t align, char **bpp)
+{
+	char *fb;
+
+	/* an exact fit may be aligned already, else ask for room to align */
+	if ((fb = index_fit(asize)) != NULL &&
+		(*bpp = align_in(fb, asize, align)) == NULL) {
+		index_insert(fb);
+		if ((fb = index_fit(asize + align + MIN_BLKSIZE)) != NULL)
+			*bpp = align_in(fb, asize, align);
+	}
+	return fb;
+}
+
+/*
+* align_in - Return the first align-aligned block pointer in free block fb
+*            whose leading slack is empty or big enough to be a free
+*            block, or NULL if asize bytes do not fit there. An asize of
+*            0 skips the fit check.
+*/
+static char *align_in(void *fb, size_t asize, size_t align)
+{
+	char *bp = (char *)(((unsigned long)fb + align - 1) & ~(unsigned long)(align - 1));
+
+	while (bp != (char *)fb && bp - (char *)fb < MIN_BLKSIZE)
+		bp += align;
+	if (asize != 0 && bp - (char *)fb + asize > GET_SIZE(HDRP(fb)))
+		return NULL;
+	return bp;
+}
+
+/*
+* adjust_size - Block size for a request of size payload bytes, including
+*               overhead and alignment reqs.
+*/
+static size_t adjust_size(size_t size)
+{
+	/* too big for a header, the callers turn it down */
+	if (size > MAX_BLKSIZE - WSIZE - ALIGNMENT)
+		return MAX_BLKSIZE + 1;
+	/* allocated blocks carry only a header, links and footer live in free blocks */
+	return MAX(MIN_BLKSIZE, ALIGNMENT * ((size + WSIZE + (ALIGNMENT - 1)) / ALIGNMENT));
+}
+
+/*
+* realloc_split - Shrink allocated block bp to asize bytes and return the
+*                 tail to the tree if it is big enough to be a free block
+*/
+static void realloc_split(void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));
+
+	if ((csize - asize) < MIN_BLKSIZE)
+		return;
+	arena->stats.splits++;
+	PUT(HDRP(bp), PACK(asize, 1 | GET_PREV_ALLOC(HDRP(bp))));
+	bp = NEXT_BLKP(bp);
+	PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
+	PUT(FTRP(bp), PACK(csize - asize, 0));
+	trim_heap(coalesce(bp));
+}
+
 /*
 * place - Place block of asize bytes at start of free block bp
 *         and split if reminder would be at least minimum block size
@@ -335,27 +2176,27 @@ static void place(void *bp, size_t asize) {
 #endif // checkheap
 	size_t csize = GET_SIZE(HDRP(bp));
 
-	if ((csize - asize) >= (DSIZE + POINTER_OVERHEAD + OVERHEAD)) {
+	if ((csize - asize) >= MIN_BLKSIZE) {
 #ifdef printre
 	printf("\nplace in case 1\n");
 #endif // printre
 		//bp = NEXT_BLKP(bp);
-		PUT(HDRP(bp), PACK(asize+DSIZE, 1));
-		PUT(FTRP(bp), PACK(asize+DSIZE, 1));
+		PUT(HDRP(bp), PACK(asize, 1 | GET_PREV_ALLOC(HDRP(bp))));
 		//printf("\nplace in case 1: bp=%p\n",bp);
 		bp = NEXT_BLKP(bp);
 		//printf("\nplace in case 1: bp=%p\n",bp);		
 		
-		PUT(HDRP(bp), PACK(csize - asize-DSIZE, 0));
-		PUT(FTRP(bp), PACK(csize - asize-DSIZE, 0));
+		PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(csize - asize, 0));
+		arena->stats.splits++;
 		//printblock(bp);
 	//	printf("\nplace in case 1, insert bp: %p\n",bp);
 		
-		tree_insert(bp);
+		index_insert(bp);
 	}
 	else {
-		PUT(HDRP(bp), PACK(csize, 1));
-		PUT(FTRP(bp), PACK(csize, 1));
+		PUT(HDRP(bp), PACK(csize, 1 | GET_PREV_ALLOC(HDRP(bp))));
+		SET_PREV_ALLOC(NEXT_BLKP(bp));
 	}
 #ifdef printre
 	printf("\nplace out\n");
@@ -370,6 +2211,7 @@ static void place(void *bp, size_t asize) {
 
 
 
+#if FREE_INDEX == FREE_INDEX_RBTREE
 /*
 *
 */
@@ -383,9 +2225,10 @@ static void *find_fit_in_tree(size_t asize)
 #endif // checkheap
 	block_t* bp;
 	block_t* temp = NULL;
-	bp = PARENT_BLK(heap_listp);
+	bp = GET_LINK(ROOTP);
 	//printf("\nbp: %p\n",bp);
 	while (bp != NULL) {
+		PROF_INC(nodes);
 		if (GET_SIZE(HDRP(bp)) < asize) {
 
 			//printf("\nfind_fit_in_tree in: case 1, bp right=%p\n", RIGHT_BLKP(bp));
@@ -396,6 +2239,8 @@ static void *find_fit_in_tree(size_t asize)
 		if (GET_SIZE(HDRP(bp)) == asize) {
 	//		printf("\nfind_fit_in_tree in: case 2\n");
 			temp = bp;
+			if (NEXT_DUP_BLK(temp) != NULL)
+				temp = NEXT_DUP_BLK(temp);
 			tree_delete(temp);
 
 			return temp;
@@ -418,7 +2263,9 @@ static void *find_fit_in_tree(size_t asize)
 #endif // printre
 
 	if (temp != NULL){
-
+		/* a list member leaves without touching the tree */
+		if (NEXT_DUP_BLK(temp) != NULL)
+			temp = NEXT_DUP_BLK(temp);
 		tree_delete(temp);
 		//printf("\nafter delete: temp: %p\n", temp);
 #ifdef checkheap
@@ -434,15 +2281,78 @@ static void *find_fit_in_tree(size_t asize)
 
 }
 
+#if TREE_FOREST
+/*
+* forest_insert - insert free block bp in the tree of its size class
+*/
+static void forest_insert(block_t *bp)
+{
+	int cls = FOREST_CLASS(GET_SIZE(HDRP(bp)));
+
+	arena->tree_rootp = FOREST_ROOTP(cls);
+	tree_insert(bp);
+	arena->forest_map |= 1u << cls;
+}
+
+/*
+* forest_delete - delete free block bp from the tree of its size class
+*/
+static void forest_delete(block_t *bp)
+{
+	int cls = FOREST_CLASS(GET_SIZE(HDRP(bp)));
+
+	arena->tree_rootp = FOREST_ROOTP(cls);
+	tree_delete(bp);
+	if (GET_LINK(arena->tree_rootp) == NULL)
+		arena->forest_map &= ~(1u << cls);
+}
+
+/*
+* forest_find_fit - best fit in the class of asize, else the smallest block
+*                   of the next non-empty class, found through forest_map
+*/
+static void *forest_find_fit(size_t asize)
+{
+	unsigned int map = arena->forest_map & (~0u << FOREST_CLASS(asize));
+	void *bp;
+	int cls;
+
+	while (map != 0) {
+		cls = __builtin_ctz(map);
+		arena->tree_rootp = FOREST_ROOTP(cls);
+		if ((bp = find_fit_in_tree(asize)) != NULL) {
+			if (GET_LINK(arena->tree_rootp) == NULL)
+				arena->forest_map &= ~(1u << cls);
+			return bp;
+		}
+		map &= map - 1;
+	}
+	return NULL;
+}
+#endif /* TREE_FOREST */
+#endif
+
 /*
 * coalesce - boundary tag coalescing. Return ptr to coalesced block
 */
 static void *coalesce(void *bp)
 {
 	//printf("\ncoalesce in\n");
-	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+	size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 	size_t size = GET_SIZE(HDRP(bp));
+
+	/* whatever follows the coalesced block now has a free block before it */
+	CLR_PREV_ALLOC(NEXT_BLKP(bp));
+	/*
+	 * a free neighbor the merged block would outgrow a header with stays
+	 * apart, so two free blocks may follow each other on a heap over 4 GB
+	 */
+	if (!next_alloc && size + GET_SIZE(HDRP(NEXT_BLKP(bp))) > MAX_BLKSIZE)
+		next_alloc = 1;
+	if (!prev_alloc && size + GET_SIZE(HDRP(PREV_BLKP(bp))) +
+		(next_alloc ? 0 : GET_SIZE(HDRP(NEXT_BLKP(bp)))) > MAX_BLKSIZE)
+		prev_alloc = 1;
 #ifdef checkheap
 	mm_checkheap(VERBOSE);
 #endif // checkheap
@@ -451,7 +2361,8 @@ static void *coalesce(void *bp)
 #ifdef printre
 	printf("\ncoalesece case 1 out\n");
 #endif // printre
-		tree_insert(bp);
+		arena->stats.coalesce[0]++;
+		index_insert(bp);
 #ifdef printre
 	printf("\ncoalesece case 1 out\n");
 #endif // printre
@@ -466,11 +2377,12 @@ static void *coalesce(void *bp)
 #ifdef printre
 	printf("\ncoalesece case 2 in\n");
 #endif // printre
-		tree_delete(NEXT_BLKP(bp));
+		arena->stats.coalesce[1]++;
+		index_delete(NEXT_BLKP(bp));
 		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-		PUT(HDRP(bp), PACK(size, 0));
+		PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
 		PUT(FTRP(bp), PACK(size, 0));
-		tree_insert(bp);
+		index_insert(bp);
 #ifdef printre
 	printf("\ncoalesece case 2 out\n");
 #endif // printre
@@ -479,13 +2391,14 @@ static void *coalesce(void *bp)
 #ifdef printre
 		printf("\ncoalesece case 3 in\n");
 #endif // printre
+		arena->stats.coalesce[2]++;
 	
-		tree_delete(PREV_BLKP(bp));
+		index_delete(PREV_BLKP(bp));
 		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
 		PUT(FTRP(bp), PACK(size, 0));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+		PUT(HDRP(PREV_BLKP(bp)), PACK(size, GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
 		bp = PREV_BLKP(bp);
-		tree_insert(bp);
+		index_insert(bp);
 #ifdef printre
 	printf("\ncoalesece case 3 out\n");
 #endif // printre
@@ -494,13 +2407,14 @@ static void *coalesce(void *bp)
 #ifdef printre
 	printf("\ncoalesece case 4 in\n");
 #endif // printre	
-		tree_delete(NEXT_BLKP(bp));
-		tree_delete(PREV_BLKP(bp));
+		arena->stats.coalesce[3]++;
+		index_delete(NEXT_BLKP(bp));
+		index_delete(PREV_BLKP(bp));
 		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+		PUT(HDRP(PREV_BLKP(bp)), PACK(size, GET_PREV_ALLOC(HDRP(PREV_BLKP(bp)))));
 		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
 		bp = PREV_BLKP(bp);
-		tree_insert(bp);
+		index_insert(bp);
 #ifdef printre
 	printf("\ncoalesece case 4 out\n");
 #endif // printre	
@@ -508,11 +2422,456 @@ static void *coalesce(void *bp)
 	return bp;
 }
 
+#if DEFER_COALESCE
+/*
+* defer_take - Take the newest buffered block that holds asize bytes and
+*              would not be split by place, or NULL
+*/
+static void *defer_take(size_t asize)
+{
+	void *bp;
+	int i;
+
+	for (i = arena->defer_count - 1; i >= 0; i--) {
+		bp = arena->defer_buf[i];
+		if (GET_SIZE(HDRP(bp)) >= asize && GET_SIZE(HDRP(bp)) - asize < MIN_BLKSIZE) {
+			arena->defer_buf[i] = arena->defer_buf[--arena->defer_count];
+			return bp;
+		}
+	}
+	return NULL;
+}
+
+/*
+* defer_flush - Free every buffered block for real, coalescing it with its
+*               neighbors and inserting the result in the free index
+*/
+static void defer_flush(void)
+{
+	void *bp;
+	size_t size;
+
+	while (arena->defer_count > 0) {
+		bp = arena->defer_buf[--arena->defer_count];
+		size = GET_SIZE(HDRP(bp));
+		PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+		PUT(FTRP(bp), PACK(size, 0));
+		trim_heap(coalesce(bp));
+	}
+}
+#endif /* DEFER_COALESCE */
+
+/*
+* slab part begin
+*/
+
+/*
+* slab_alloc - Hand out an object of the size class of size from the
+*              first slab with a free object, starting a new slab if
+*              the class has none
+*/
+static void *slab_alloc(size_t size)
+{
+	int cls = SLAB_CLASS(size);
+	slab_t *s = arena->slab_partial[cls];
+	unsigned int i, bit;
+
+	if (s == NULL && (s = slab_new(cls)) == NULL)
+		return NULL;
+
+	for (i = 0; s->map[i] == ~0u; i++)
+		;
+	bit = __builtin_ctz(~s->map[i]);
+	s->map[i] |= 1u << bit;
+
+	/* a full slab leaves the class list until something is freed */
+	if (--s->nfree == 0) {
+		arena->slab_partial[cls] = s->next;
+		if (s->next != NULL)
+			s->next->prev = NULL;
+		s->next = NULL;
+	}
+	return (char *)s + SLAB_HDRSIZE + (i * 32 + bit) * s->osize;
+}
+
+/*
+* slab_free - Return a slab object; an empty slab goes back to the tree
+*             unless it is the only slab left in its class
+*/
+static void slab_free(void *bp)
+{
+	slab_t *s = SLAB_OF(bp);
+	int cls = SLAB_CLASS(s->osize);
+	unsigned int idx = ((char *)bp - (char *)s - SLAB_HDRSIZE) / s->osize;
+	unsigned int page;
+
+	s->map[idx / 32] &= ~(1u << (idx % 32));
+
+	/* was full, put it back on the class list */
+	if (s->nfree++ == 0) {
+		s->prev = NULL;
+		s->next = arena->slab_partial[cls];
+		if (s->next != NULL)
+			s->next->prev = s;
+		arena->slab_partial[cls] = s;
+	}
+
+	if (s->nfree < s->nobjs || (s->prev == NULL && s->next == NULL))
+		return;
+
+	if (s->prev != NULL)
+		s->prev->next = s->next;
+	else
+		arena->slab_partial[cls] = s->next;
+	if (s->next != NULL)
+		s->next->prev = s->prev;
+
+	page = SLAB_PAGE(s);
+	__sync_fetch_and_and(&arena->slab_map[page / 32], ~(1u << (page % 32)));
+	PUT(HDRP(s), PACK(GET_SIZE(HDRP(s)), GET_PREV_ALLOC(HDRP(s))));
+	PUT(FTRP(s), PACK(GET_SIZE(HDRP(s)), 0));
+	trim_heap(coalesce(s));
+}
+
+/*
+* slab_new - Carve a page aligned slab for class cls off the end of the
+*            heap. The slab is an ordinary allocated block to the rest
+*            of the allocator, with the page as its payload.
+*/
+static slab_t *slab_new(int cls)
+{
+	char *page;
+	unsigned int n;
+	slab_t *s;
+
+	/* header, page, pad to ALIGNMENT */
+	if ((page = alloc_aligned(SLAB_SIZE + ALIGNMENT, SLAB_SIZE)) == NULL)
+		return NULL;
+
+	s = (slab_t *)page;
+	s->osize = (cls + 1) * ALIGNMENT;
+	s->nobjs = (SLAB_SIZE - SLAB_HDRSIZE) / s->osize;
+	s->nfree = s->nobjs;
+	memset(s->map, 0, sizeof(s->map));
+	/* mark the slots past nobjs as in use so slab_alloc never finds them */
+	for (n = s->nobjs; n < SLAB_MAPWORDS * 32; n++)
+		s->map[n / 32] |= 1u << (n % 32);
+	s->prev = NULL;
+	s->next = NULL;
+	arena->slab_partial[cls] = s;
+
+	n = SLAB_PAGE(s);
+	__sync_fetch_and_or(&arena->slab_map[n / 32], 1u << (n % 32));
+	arena->slab_words = MAX(arena->slab_words, n / 32 + 1);
+	return s;
+}
+
+#if FREE_INDEX == FREE_INDEX_TLSF
+/*
+* tlsf part begin
+*
+* Two-level segregated fit. The first level splits sizes by power of two,
+* the second splits each power of two into TLSF_SL_COUNT lists of equal
+* width. A bit per list in tlsf_sl_map and a bit per first level in
+* tlsf_fl_map say which lists are non-empty, so a fit is found with two
+* ctz lookups and no search.
+*/
+
+/*
+* tlsf_mapping - first and second level of the list holding size bytes
+*/
+static void tlsf_mapping(size_t size, int *fl, int *sl)
+{
+	int t;
+
+	if (size < TLSF_SMALL) {
+		*fl = 0;
+		*sl = size / DSIZE;
+		return;
+	}
+	/* a fit rounded up past the largest block maps past the last level */
+	t = 63 - __builtin_clzll((unsigned long long)size);
+	*fl = t - TLSF_FL_SHIFT + 1;
+	*sl = (size >> (t - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+}
+
+/*
+* tlsf_insert - push free block bp on the front of its list
+*/
+static void tlsf_insert(block_t *bp)
+{
+	block_t *head;
+	int fl, sl;
+
+	tlsf_mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+	head = arena->tlsf_heads[fl][sl];
+	PUT_ADDRESS(NEXT_FREEP(bp), head);
+	PUT_ADDRESS(PREV_FREEP(bp), NULL);
+	if (head != NULL)
+		PUT_ADDRESS(PREV_FREEP(head), bp);
+	arena->tlsf_heads[fl][sl] = bp;
+	arena->tlsf_fl_map |= 1u << fl;
+	arena->tlsf_sl_map[fl] |= 1u << sl;
+}
+
+/*
+* tlsf_delete - unlink free block bp, clearing the bits of a list it empties
+*/
+static void tlsf_delete(block_t *bp)
+{
+	block_t *next = NEXT_FREE(bp);
+	block_t *prev = PREV_FREE(bp);
+	int fl, sl;
+
+	if (next != NULL)
+		PUT_ADDRESS(PREV_FREEP(next), prev);
+	if (prev != NULL) {
+		PUT_ADDRESS(NEXT_FREEP(prev), next);
+		return;
+	}
+	tlsf_mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+	arena->tlsf_heads[fl][sl] = next;
+	if (next == NULL && (arena->tlsf_sl_map[fl] &= ~(1u << sl)) == 0)
+		arena->tlsf_fl_map &= ~(1u << fl);
+}
+
+/*
+* tlsf_find_fit - take the first block of the first non-empty list whose
+*                 blocks are all at least asize bytes
+*/
+static void *tlsf_find_fit(size_t asize)
+{
+	block_t *bp;
+	unsigned int map;
+	int fl, sl;
+
+	/* round up to the next list boundary, every block from there on fits */
+	if (asize >= TLSF_SMALL)
+		asize += (1u << (31 - __builtin_clz((unsigned int)asize) - TLSF_SL_LOG2)) - 1;
+	tlsf_mapping(asize, &fl, &sl);
+	if (fl >= TLSF_FL_COUNT)
+		return NULL;
+
+	map = arena->tlsf_sl_map[fl] & (~0u << sl);
+	if (map == 0) {
+		map = arena->tlsf_fl_map & (~0u << (fl + 1));
+		if (map == 0)
+			return NULL;
+		fl = __builtin_ctz(map);
+		map = arena->tlsf_sl_map[fl];
+	}
+	sl = __builtin_ctz(map);
+	bp = arena->tlsf_heads[fl][sl];
+	tlsf_delete(bp);
+	return bp;
+}
+
+#else
 /*
 * red black tree part begin
 */
 
 
+/*
+* dup_insert - add free block bp to the list of tree node x, same size
+*/
+static void dup_insert(block_t *x, block_t *bp) {
+	SET_DUP(bp);
+	PUT_ADDRESS(PREV_DUP_BLKP(bp), x);
+	PUT_ADDRESS(NEXT_DUP_BLKP(bp), NEXT_DUP_BLK(x));
+	if (NEXT_DUP_BLK(x) != NULL)
+		PUT_ADDRESS(PREV_DUP_BLKP(NEXT_DUP_BLK(x)), bp);
+	PUT_ADDRESS(NEXT_DUP_BLKP(x), bp);
+}
+
+#if TOPDOWN_TREE
+/*
+* Top-down red black tree without parent links, after Julienne Walker's
+* single pass insert and delete. Nodes are recolored and rotated on the
+* way down, so nothing has to be fixed up on the way back. Colors are
+* only kept in the header, footers of tree nodes are not recolored.
+*/
+#define LINKP(bp, dir) ((char* )(bp)+(dir)*LSIZE)
+#define LINK(bp, dir) GET_LINK(LINKP(bp, dir))
+#define IS_RED_BLK(bp) ((bp) != NULL && IS_RED(bp))
+#define SET_COLOR(bp, c) PUT(HDRP(bp), PACK(GET_SIZE_ALLOC(HDRP(bp)), (c) << 1))
+
+/*
+* single_rotate - rotate bp towards dir, return the new subtree root
+*/
+static block_t *single_rotate(block_t *bp, int dir) {
+	block_t* save = LINK(bp, !dir);
+
+	PROF_INC(rotations);
+	PUT_ADDRESS(LINKP(bp, !dir), LINK(save, dir));
+	PUT_ADDRESS(LINKP(save, dir), bp);
+	SET_COLOR(bp, RED);
+	SET_COLOR(save, BLACK);
+	return save;
+}
+
+static block_t *double_rotate(block_t *bp, int dir) {
+	PUT_ADDRESS(LINKP(bp, !dir), single_rotate(LINK(bp, !dir), !dir));
+	return single_rotate(bp, dir);
+}
+
+/*
+* tree insert
+* bp is free block pointer. Splits 4-nodes on the way down and joins
+* the list of an existing node of the same size.
+*/
+static void tree_insert(block_t* bp) {
+	block_t* head = TREE_HEAD;
+	block_t *t, *g, *p, *q;
+	size_t size = GET_SIZE(HDRP(bp));
+	int dir = 0, last = 0;
+
+	PUT_ADDRESS(LEFT_BLKP(bp), NULL);
+	PUT_ADDRESS(RIGHT_BLKP(bp), NULL);
+	PUT_ADDRESS(NEXT_DUP_BLKP(bp), NULL);
+	SET_COLOR(bp, RED);
+
+	if ((q = GET_LINK(ROOTP)) == NULL) {
+		PUT_ADDRESS(ROOTP, bp);
+		SET_COLOR(bp, BLACK);
+		return;
+	}
+	t = head;
+	g = p = NULL;
+	for (;;) {
+		if (q == NULL) {
+			PUT_ADDRESS(LINKP(p, dir), bp);
+			q = bp;
+		}
+		else if (IS_RED_BLK(LINK(q, 0)) && IS_RED_BLK(LINK(q, 1))) {
+			SET_COLOR(q, RED);
+			SET_COLOR(LINK(q, 0), BLACK);
+			SET_COLOR(LINK(q, 1), BLACK);
+		}
+		/* two reds in a row after the insert or the split */
+		if (IS_RED(q) && IS_RED_BLK(p)) {
+			int dir2 = LINK(t, 1) == g;
+			if (q == LINK(p, last))
+				PUT_ADDRESS(LINKP(t, dir2), single_rotate(g, !last));
+			else
+				PUT_ADDRESS(LINKP(t, dir2), double_rotate(g, !last));
+		}
+		if (GET_SIZE(HDRP(q)) == size)
+			break;
+		last = dir;
+		dir = GET_SIZE(HDRP(q)) < size;
+		if (g != NULL)
+			t = g;
+		g = p;
+		p = q;
+		q = LINK(q, dir);
+	}
+	if (q != bp)
+		dup_insert(q, bp);
+	SET_COLOR(GET_LINK(ROOTP), BLACK);
+}
+
+/*
+* tree delete
+* Pushes a red node down along the path to z, then unlinks the last
+* node on the path (z or its predecessor) and puts it in z's place.
+* The link to z is tracked through the rotations instead of a parent.
+*/
+static void tree_delete(block_t *z) {
+	block_t* head = TREE_HEAD;
+	block_t *q = head, *p = NULL, *g = NULL, *f = NULL, *fp = NULL, *s, *r;
+	size_t size = GET_SIZE(HDRP(z));
+	int dir = 1, last, fdir = 0;
+
+	/* list members and nodes with a list never rebalance */
+	if (IS_DUP(z)) {
+		PUT_ADDRESS(NEXT_DUP_BLKP(PREV_DUP_BLK(z)), NEXT_DUP_BLK(z));
+		if (NEXT_DUP_BLK(z) != NULL)
+			PUT_ADDRESS(PREV_DUP_BLKP(NEXT_DUP_BLK(z)), PREV_DUP_BLK(z));
+		return;
+	}
+	if (NEXT_DUP_BLK(z) != NULL) {
+		dup_promote(z);
+		return;
+	}
+
+	while (LINK(q, dir) != NULL) {
+		last = dir;
+		g = p;
+		p = q;
+		q = LINK(q, dir);
+		dir = GET_SIZE(HDRP(q)) < size;
+		if (q == z) {
+			f = q;
+			fp = p;
+			fdir = last;
+		}
+		if (IS_RED(q) || IS_RED_BLK(LINK(q, dir)))
+			continue;
+		if (IS_RED_BLK(LINK(q, !dir))) {
+			r = single_rotate(q, dir);
+			PUT_ADDRESS(LINKP(p, last), r);
+			if (q == f) {
+				fp = r;
+				fdir = dir;
+			}
+			p = r;
+		}
+		else if ((s = LINK(p, !last)) != NULL) {
+			if (!IS_RED_BLK(LINK(s, !last)) && !IS_RED_BLK(LINK(s, last))) {
+				SET_COLOR(p, BLACK);
+				SET_COLOR(s, RED);
+				SET_COLOR(q, RED);
+			}
+			else {
+				int dir2 = LINK(g, 1) == p;
+				if (IS_RED_BLK(LINK(s, last)))
+					r = double_rotate(p, last);
+				else
+					r = single_rotate(p, last);
+				PUT_ADDRESS(LINKP(g, dir2), r);
+				if (p == f) {
+					fp = r;
+					fdir = last;
+				}
+				SET_COLOR(q, RED);
+				SET_COLOR(r, RED);
+				SET_COLOR(LINK(r, 0), BLACK);
+				SET_COLOR(LINK(r, 1), BLACK);
+			}
+		}
+	}
+
+	/* q has at most one child, unlink it and let it stand in for z */
+	PUT_ADDRESS(LINKP(p, LINK(p, 1) == q), LINK(q, LINK(q, 0) == NULL));
+	if (q != f) {
+		PUT_ADDRESS(LEFT_BLKP(q), LEFT_BLK(f));
+		PUT_ADDRESS(RIGHT_BLKP(q), RIGHT_BLK(f));
+		SET_COLOR(q, IS_RED(f));
+		PUT_ADDRESS(LINKP(fp, fdir), q);
+	}
+	if (GET_LINK(ROOTP) != NULL)
+		SET_COLOR(GET_LINK(ROOTP), BLACK);
+}
+
+/*
+* dup_promote - replace tree node z by the first block of its list,
+*               the link to z is found by walking down from the root
+*/
+static void dup_promote(block_t *z) {
+	block_t* d = NEXT_DUP_BLK(z);
+	char* link = ROOTP;
+	size_t size = GET_SIZE(HDRP(z));
+
+	while (GET_LINK(link) != z)
+		link = LINKP(GET_LINK(link), GET_SIZE(HDRP(GET_LINK(link))) < size);
+	PUT_ADDRESS(LEFT_BLKP(d), LEFT_BLK(z));
+	PUT_ADDRESS(RIGHT_BLKP(d), RIGHT_BLK(z));
+	SET_COLOR(d, IS_RED(z));
+	PUT_ADDRESS(link, d);
+}
+
+#else
 /*
 * tree insert
 * bp is free block pointer.
@@ -520,14 +2879,18 @@ static void *coalesce(void *bp)
 static void tree_insert(block_t* bp) {
 	PUT(HDRP(bp), PACK(GET_SIZE_ALLOC(HDRP(bp)), RED << 1));
 	PUT(FTRP(bp), PACK(GET_SIZE_ALLOC(FTRP(bp)), RED << 1));
-	block_t*  x = GET_ADDRESS(heap_listp);
-	x = *x;
+	block_t*  x = GET_LINK(ROOTP);
 	block_t*  y = NULL;
 
 	while ((x) != NULL) {
 
 		y = x;
 		//	printf("\n in while: y=%p,x=%p,x left=%p,x right=%p\n", (char*)y, (char*)x, (char*)LEFT_BLK(x), (char*)LEFT_BLK(x));
+		if (GET_SIZE(HDRP(bp)) == GET_SIZE(HDRP(x))) {
+			/* size already in the tree, join its list */
+			dup_insert(x, bp);
+			return;
+		}
 		if (GET_SIZE(HDRP(bp)) < GET_SIZE(HDRP(x)))
 			x = LEFT_BLK(x);
 		else
@@ -535,11 +2898,11 @@ static void tree_insert(block_t* bp) {
 	}
 	//printf("\nout of while: x=%p, bp=%p, y=%p\n",(char*)x,(char*)bp,(char*)y);
 
-	PARENT_BLK(bp) = y;
+	PUT_ADDRESS(PARENT_BLKP(bp), y);
 	//pt();
 	if (y == NULL) {
 
-		PUT_ADDRESS(heap_listp, bp);
+		PUT_ADDRESS(ROOTP, bp);
 	}
 	else {
 		//	printf("\ny left=%p, y right=%p, bp=%p\n", LEFT_BLKP(y), RIGHT_BLKP(y), bp);
@@ -551,6 +2914,7 @@ static void tree_insert(block_t* bp) {
 	}
 	PUT_ADDRESS(LEFT_BLKP(bp), 0);
 	PUT_ADDRESS(RIGHT_BLKP(bp), 0);
+	PUT_ADDRESS(NEXT_DUP_BLKP(bp), 0);
 	PUT(HDRP(bp), PACK(GET_SIZE_ALLOC(HDRP(bp)), RED << 1));
 	PUT(FTRP(bp), PACK(GET_SIZE_ALLOC(FTRP(bp)), RED << 1));
 	//pt();
@@ -563,6 +2927,19 @@ static void tree_delete(block_t *z) {
 	block_t*par = NULL;
 	block_t* x = NULL;
 	int yoc;
+
+	/* list members and nodes with a list never rebalance */
+	if (IS_DUP(z)) {
+		PUT_ADDRESS(NEXT_DUP_BLKP(PREV_DUP_BLK(z)), NEXT_DUP_BLK(z));
+		if (NEXT_DUP_BLK(z) != NULL)
+			PUT_ADDRESS(PREV_DUP_BLKP(NEXT_DUP_BLK(z)), PREV_DUP_BLK(z));
+		return;
+	}
+	if (NEXT_DUP_BLK(z) != NULL) {
+		dup_promote(z);
+		return;
+	}
+
 	yoc = IS_RED(y);
 	if (LEFT_BLK(z) == NULL) {
 		x = RIGHT_BLK(z);
@@ -612,13 +2989,14 @@ static void tree_delete(block_t *z) {
 
 static void right_rotate(block_t* bp) {
 	block_t* x = NULL;
+	PROF_INC(rotations);
 	x = LEFT_BLK(bp);
 	PUT_ADDRESS(LEFT_BLKP(bp), RIGHT_BLK(x));
 	if (RIGHT_BLK(x) != NULL)
 		PUT_ADDRESS(PARENT_BLKP(RIGHT_BLK(x)), bp);
 	PUT_ADDRESS(PARENT_BLKP(x), PARENT_BLK(bp));
 	if (PARENT_BLK(bp) == NULL)
-		PUT_ADDRESS(heap_listp, x);
+		PUT_ADDRESS(ROOTP, x);
 	else {
 		if (bp == RIGHT_BLK(PARENT_BLK(bp)))
 			PUT_ADDRESS(RIGHT_BLKP(PARENT_BLK(bp)), x);
@@ -631,6 +3009,7 @@ static void right_rotate(block_t* bp) {
 }
 static void left_rotate(block_t *bp) {
 	block_t* y = NULL;
+	PROF_INC(rotations);
 	y = RIGHT_BLK(bp);
 	PUT_ADDRESS(RIGHT_BLKP(bp), LEFT_BLK(y));
 	if (LEFT_BLK(y) != NULL) {
@@ -638,7 +3017,7 @@ static void left_rotate(block_t *bp) {
 	}
 	PUT_ADDRESS(PARENT_BLKP(y), PARENT_BLK(bp));
 	if (PARENT_BLK(bp) == NULL) {
-		PUT_ADDRESS(heap_listp, y);
+		PUT_ADDRESS(ROOTP, y);
 	}
 	else {
 		if (bp == LEFT_BLK(PARENT_BLK(bp))) {
@@ -656,7 +3035,7 @@ static void left_rotate(block_t *bp) {
 
 static void transplant(block_t* u, block_t* v) {
 	if (PARENT_BLK(u) == NULL) {
-		PUT_ADDRESS(heap_listp, v);
+		PUT_ADDRESS(ROOTP, v);
 
 	}
 	else if (u == LEFT_BLK(PARENT_BLK(u))) {
@@ -682,6 +3061,24 @@ static void transplant(block_t* u, block_t* v) {
 	return;
 }
 
+/*
+* dup_promote - replace tree node z by the first block of its list
+*/
+static void dup_promote(block_t *z) {
+	block_t* d = NEXT_DUP_BLK(z);
+
+	transplant(z, d);
+	PUT_ADDRESS(LEFT_BLKP(d), LEFT_BLK(z));
+	PUT_ADDRESS(RIGHT_BLKP(d), RIGHT_BLK(z));
+	if (LEFT_BLK(d) != NULL)
+		PUT_ADDRESS(PARENT_BLKP(LEFT_BLK(d)), d);
+	if (RIGHT_BLK(d) != NULL)
+		PUT_ADDRESS(PARENT_BLKP(RIGHT_BLK(d)), d);
+	PUT(HDRP(d), PACK(GET_SIZE_ALLOC(HDRP(d)), IS_RED(z) << 1));
+	PUT(FTRP(d), PACK(GET_SIZE_ALLOC(FTRP(d)), IS_RED(z) << 1));
+	return;
+}
+
 static block_t* minimum(block_t *bp) {
 	//printf("\nminimum in\n");
 	//bp=PARENT_BLK(bp);
@@ -694,7 +3091,7 @@ static block_t* minimum(block_t *bp) {
 
 static void delete_fixup(block_t * x, block_t *par) {
 	block_t* w = NULL;
-	while (x != PARENT_BLK(heap_listp) && (x == NULL || !IS_RED(x))) {
+	while (x != GET_LINK(ROOTP) && (x == NULL || !IS_RED(x))) {
 
 		if (x == LEFT_BLK(par)) {
 			w = RIGHT_BLK(par);
@@ -730,7 +3127,7 @@ static void delete_fixup(block_t * x, block_t *par) {
 				PUT(HDRP(RIGHT_BLK(w)), PACK(GET_SIZE_ALLOC(HDRP(RIGHT_BLK(w))), BLACK << 1));
 				PUT(FTRP(RIGHT_BLK(w)), PACK(GET_SIZE_ALLOC(FTRP(RIGHT_BLK(w))), BLACK << 1));
 				left_rotate(par);
-				x = PARENT_BLK(heap_listp);
+				x = GET_LINK(ROOTP);
 			}
 		}
 		else {
@@ -766,7 +3163,7 @@ static void delete_fixup(block_t * x, block_t *par) {
 				PUT(HDRP(LEFT_BLK(w)), PACK(GET_SIZE_ALLOC(HDRP(LEFT_BLK(w))), BLACK << 1));
 				PUT(FTRP(LEFT_BLK(w)), PACK(GET_SIZE_ALLOC(FTRP(LEFT_BLK(w))), BLACK << 1));
 				right_rotate(par);
-				x = PARENT_BLK(heap_listp);
+				x = GET_LINK(ROOTP);
 			}
 		}
 	}
@@ -834,35 +3231,50 @@ static void insert_fixup(block_t* bp) {
 			}
 		}
 	}
-	PUT(HDRP(PARENT_BLK(heap_listp)), PACK(GET_SIZE_ALLOC(HDRP(PARENT_BLK((heap_listp)))), BLACK << 1));
-	PUT(FTRP(PARENT_BLK(heap_listp)), PACK(GET_SIZE_ALLOC(FTRP(PARENT_BLK((heap_listp)))), BLACK << 1));
+	PUT(HDRP(GET_LINK(ROOTP)), PACK(GET_SIZE_ALLOC(HDRP(GET_LINK(ROOTP))), BLACK << 1));
+	PUT(FTRP(GET_LINK(ROOTP)), PACK(GET_SIZE_ALLOC(FTRP(GET_LINK(ROOTP))), BLACK << 1));
 	return;
 }
+#endif /* TOPDOWN_TREE */
+#endif /* FREE_INDEX */
 
 static void printblock(void *bp)
 {
-	size_t hsize, halloc, fsize, falloc;
+	uint32_t hsize, halloc, fsize, falloc;
 
 	hsize = GET_SIZE(HDRP(bp));
 	halloc = GET_ALLOC(HDRP(bp));
-	fsize = GET_SIZE(FTRP(bp));
-	falloc = GET_ALLOC(FTRP(bp));
 
 	if (hsize == 0) {
 		printf("%p: EOL\n", bp);
 		return;
 	}
+	if (halloc) {
+		printf("%p: header: [%d:a] prev: %c\n", bp, hsize, GET_PREV_ALLOC(HDRP(bp)) ? 'a' : 'f');
+		return;
+	}
+	fsize = GET_SIZE(FTRP(bp));
+	falloc = GET_ALLOC(FTRP(bp));
 
-	printf("%p: header: [%d:%c] footer: [%d:%c] color: %d, prev: %p, next: %p, parent: %p, left: %p, right: %p\n", bp,
+#if FREE_INDEX == FREE_INDEX_TLSF
+	printf("%p: header: [%d:%c] footer: [%d:%c] next: %p, next free: %p, prev free: %p\n", bp,
+	hsize, (halloc ? 'a' : 'f'),
+	fsize, (falloc ? 'a' : 'f'), (char*)NEXT_BLKP(bp), (char*)NEXT_FREE(bp), (char*)PREV_FREE(bp));
+#else
+	printf("%p: header: [%d:%c] footer: [%d:%c] color: %d, next: %p, left: %p, right: %p\n", bp,
 	hsize, (halloc ? 'a' : 'f'),
-	fsize, (falloc ? 'a' : 'f'), IS_RED(bp), (char*)PREV_BLKP(bp), (char*)NEXT_BLKP(bp), (char*)PARENT_BLK(bp), (char*)LEFT_BLK(bp), (char*)RIGHT_BLK(bp));
+	fsize, (falloc ? 'a' : 'f'), IS_RED(bp), (char*)NEXT_BLKP(bp), (char*)LEFT_BLK(bp), (char*)RIGHT_BLK(bp));
+#endif
 }
 
 static void checkblock(void *bp)
 {
-	if ((size_t)bp % 8)
-		printf("Error: %p is not doubleword aligned\n", bp);
-	if (GET_SIZE_ALLOC(HDRP(bp)) != GET_SIZE_ALLOC(FTRP(bp)))
+	if ((size_t)bp % ALIGNMENT)
+		printf("Error: %p is not %d-byte aligned\n", bp, ALIGNMENT);
+	/* only free blocks have a footer */
+	if (!GET_ALLOC(HDRP(bp)) && (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)) || GET_ALLOC(FTRP(bp))))
 		printf("Error: header does not match footer: header:%x, footer:%x\n", GET(HDRP(bp)), GET(FTRP(bp)));
+	if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != !GET_ALLOC(HDRP(bp)))
+		printf("Error: prev-alloc bit of %p does not match %p\n", NEXT_BLKP(bp), bp);
 }
 
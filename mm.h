@@ -4,6 +4,92 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern int mm_malloc_batch(size_t size, int n, void **out);
+extern void mm_free_batch(void **ptrs, int n);
+extern void *mm_memalign(size_t align, size_t size);
+extern void *mm_aligned_alloc(size_t align, size_t size);
+/* Thread cache lookups and hits of the calling thread, 0 without THREAD_CACHE */
+extern void mm_cache_stats(unsigned long *lookups, unsigned long *hits);
+
+/* Counters of mm_get_stats, kept up to date by every call */
+typedef struct {
+    size_t heap_bytes;        /* arena heaps and huge mappings */
+    size_t live_bytes;        /* heap bytes not in free blocks */
+    size_t free_bytes;        /* bytes in the free index */
+    unsigned long free_blocks;
+    int tree_height;          /* leftmost path of the free tree, at least
+				 half the height; 0 for TLSF */
+    unsigned long extends;    /* extend_heap calls */
+    unsigned long splits;     /* free blocks split on allocation */
+    unsigned long coalesce[4];/* frees with no, next, prev, both neighbors free */
+    unsigned long realloc_inplace;
+    unsigned long realloc_moved;
+    unsigned long pools;      /* pools of mm_pool_create */
+    size_t pool_bytes;        /* of their chunks, part of live_bytes */
+    unsigned long pool_objects; /* carved from the chunks */
+    unsigned long pool_in_use;  /* of those, handed out by mm_pool_get */
+} mm_stats_t;
+
+extern void mm_get_stats(mm_stats_t *st);
+
+/*
+ * Separate heaps, each in address space of its own and capped at the
+ * size it was made with. A NULL heap is the default one of mm_malloc.
+ * mm_free and mm_realloc take a block of a created heap as well, it is
+ * found by address and stays in its heap.
+ */
+typedef struct mm_heap mm_heap_t;
+
+extern mm_heap_t *mm_heap_create(size_t size);
+extern void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+extern void mm_heap_free(mm_heap_t *heap, void *ptr);
+extern void mm_heap_destroy(mm_heap_t *heap);
+extern void mm_heap_stats(mm_heap_t *heap, mm_stats_t *st);
+
+/*
+ * Regions: bump allocation in chunks of the default heap, freed only all
+ * together by reset or destroy. A region is not thread safe.
+ */
+typedef struct mm_region mm_region_t;
+
+extern mm_region_t *mm_region_create(size_t chunk);
+extern void *mm_region_alloc(mm_region_t *region, size_t size);
+extern void mm_region_free(mm_region_t *region, void *ptr);
+extern void mm_region_reset(mm_region_t *region);
+extern void mm_region_destroy(mm_region_t *region);
+
+/*
+ * Pools of fixed-size objects on a free list, with chunks from the
+ * default heap. A pool is not thread safe.
+ */
+typedef struct mm_pool mm_pool_t;
+
+extern mm_pool_t *mm_pool_create(size_t obj_size, size_t align);
+extern void *mm_pool_get(mm_pool_t *pool);
+extern void mm_pool_put(mm_pool_t *pool, void *obj);
+extern void mm_pool_destroy(mm_pool_t *pool);
+
+/* Power of two histogram: bucket 0 counts zeros, bucket b values below 2^b */
+#define MM_HIST_BUCKETS 32
+typedef struct {
+    unsigned long n;
+    unsigned long long sum;
+    unsigned long bucket[MM_HIST_BUCKETS];
+} mm_hist_t;
+
+/* Histograms of an MM_PROFILE build, per thread */
+typedef struct {
+    mm_hist_t malloc_cycles;
+    mm_hist_t free_cycles;
+    mm_hist_t realloc_cycles;
+    mm_hist_t search_nodes;     /* tree nodes visited per index_fit */
+    mm_hist_t insert_rotations; /* per free index insert */
+    mm_hist_t delete_rotations; /* per free index delete or fit */
+} mm_profile_t;
+
+/* Copy and restart the calling thread's histograms, all 0 without MM_PROFILE */
+extern void mm_get_profile(mm_profile_t *prof);
 
 
 /* 